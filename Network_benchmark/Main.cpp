@@ -0,0 +1,575 @@
+#include "User/Client.h"
+#include "User/Server.h"
+#include "Utility/Interest_grid.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+/**
+ *   Benchmarks for comparing the options and the implementations of the framework.
+ *   Usage: Network_benchmark <benchmark> [name=value ...]. Run without arguments to see the benchmarks.
+ *   Everything runs in this process so the numbers include both the server and the client side.
+ */
+
+using Clock = std::chrono::steady_clock;
+using Microseconds = std::chrono::duration<double, std::micro>;
+
+enum class Message_id : uint8_t
+{
+    echo
+};
+
+// How the clients connect to the echo server
+enum class Transport : uint8_t
+{
+    tcp,
+    local,
+    loopback,
+    shared_memory
+};
+
+const std::vector<std::pair<std::string_view, Transport>> TRANSPORT_NAMES = {
+    {"tcp", Transport::tcp},
+    {"local", Transport::local},
+    {"loopback", Transport::loopback},
+    {"shared_memory", Transport::shared_memory}};
+
+[[nodiscard]] Transport parse_transport(std::string_view name)
+{
+    for (const auto& [transport_name, transport] : TRANSPORT_NAMES)
+        if (transport_name == name)
+            return transport;
+
+    throw std::invalid_argument("Unknown transport " + std::string(name));
+}
+
+[[nodiscard]] Net::Connection_pipeline parse_pipeline(std::string_view name)
+{
+    if (name == "callbacks")
+        return Net::Connection_pipeline::callbacks;
+
+    if (name == "coroutines")
+        return Net::Connection_pipeline::coroutines;
+
+    throw std::invalid_argument("Unknown pipeline " + std::string(name));
+}
+
+// Arguments given as name=value
+class Arguments
+{
+public:
+    Arguments(int argc, char** argv)
+    {
+        for (int i = 2; i < argc; ++i)
+        {
+            const std::string_view argument = argv[i];
+            const size_t separator = argument.find('=');
+
+            if (separator == std::string_view::npos)
+                throw std::invalid_argument("Arguments should be name=value but got " + std::string(argument));
+
+            m_values.emplace(argument.substr(0, separator), argument.substr(separator + 1));
+        }
+    }
+
+    [[nodiscard]] std::string get(const std::string& name, std::string_view default_value) const
+    {
+        auto found_value = m_values.find(name);
+        return found_value != m_values.end() ? found_value->second : std::string(default_value);
+    }
+
+    [[nodiscard]] size_t get_number(const std::string& name, size_t default_value) const
+    {
+        auto found_value = m_values.find(name);
+        return found_value != m_values.end() ? std::stoull(found_value->second) : default_value;
+    }
+
+private:
+    std::unordered_map<std::string, std::string> m_values;
+};
+
+// Prints only the errors so a broken setup is not mistaken for a slow one
+void print_error(std::string_view notification, Net::Severity severity)
+{
+    if (severity == Net::Severity::error)
+        std::cout << "  " << notification << "\n";
+}
+
+/**
+ *   Server that writes back every message it receives. The update runs in its own thread and waits for the messages
+ *   like the servers usually do.
+ */
+class Echo_server
+{
+public:
+    /**
+     *   @param how the clients connect to the server
+     *   @param port of the tcp endpoint. The paths of the other endpoints are made from it.
+     *   @param options of the tcp sockets
+     *   @param how the connections read and write the messages
+     *   @throws if the transport is not supported in this platform
+     */
+    Echo_server(Transport transport, uint16_t port, const Net::Socket_options& options,
+                Net::Connection_pipeline pipeline)
+        : m_transport(transport),
+          m_port(port),
+          m_path((std::filesystem::temp_directory_path() / ("Network_benchmark_" + std::to_string(port))).string()),
+          m_server(create_server())
+    {
+        m_server->add_accepted_message(Message_id::echo);
+        m_server->set_socket_options(options);
+        m_server->set_connection_pipeline(pipeline);
+        m_server->m_on_notification.set_callback(print_error);
+        m_server->m_on_message.set_callback(
+            [this](const Net::Client_information& client, Net::Message<Message_id> message) {
+                m_server->send_message_to_client(client.m_id, std::move(message));
+            });
+
+        if (m_transport == Transport::loopback)
+            m_loopback_acceptor = &m_server->add_loopback_endpoint();
+
+        else if (m_transport == Transport::shared_memory)
+        {
+#if defined(__linux__)
+            m_server->add_shared_memory_endpoint(m_path);
+#else
+            throw std::invalid_argument("Shared memory transport is only supported on Linux");
+#endif
+        }
+    }
+
+    Echo_server(const Echo_server&) = delete;
+    Echo_server(Echo_server&&) = delete;
+
+    ~Echo_server()
+    {
+        m_is_running = false;
+
+        if (m_update_thread.joinable())
+            m_update_thread.join();
+    }
+
+    Echo_server& operator=(const Echo_server&) = delete;
+    Echo_server& operator=(Echo_server&&) = delete;
+
+    void start()
+    {
+        m_server->start();
+        m_update_thread = std::thread([this] {
+            // The interval only wakes the update up so the thread notices that it should stop
+            while (m_is_running)
+                m_server->update(Net::SIZE_T_MAX, true, std::chrono::seconds(1));
+        });
+    }
+
+    // Starts connecting the client to the endpoint of the transport
+    void connect(Net::Client<Message_id>& client) const
+    {
+        switch (m_transport)
+        {
+        case Transport::tcp:
+            client.connect("127.0.0.1", std::to_string(m_port));
+            break;
+        case Transport::local:
+            client.connect(Net::Local_protocol::endpoint(m_path));
+            break;
+        case Transport::loopback:
+            client.connect(*m_loopback_acceptor);
+            break;
+        case Transport::shared_memory:
+#if defined(__linux__)
+            client.connect_shared_memory(m_path);
+#endif
+            break;
+        }
+    }
+
+private:
+    [[nodiscard]] std::unique_ptr<Net::Server<Message_id>> create_server() const
+    {
+        if (m_transport == Transport::local)
+            return std::make_unique<Net::Server<Message_id>>(Net::Local_protocol::endpoint(m_path));
+
+        // The loopback and shared memory endpoints are added next to the tcp one
+        return std::make_unique<Net::Server<Message_id>>(m_port);
+    }
+
+    Transport m_transport = Transport::tcp;
+    uint16_t m_port = 0;
+    std::string m_path;
+
+    std::unique_ptr<Net::Server<Message_id>> m_server;
+    Net::Loopback_acceptor* m_loopback_acceptor = nullptr;
+    std::atomic<bool> m_is_running = true;
+    std::thread m_update_thread;
+};
+
+/**
+ *   Client that counts the echoed messages. They are counted in the Asio thread of the client so the benchmark
+ *   doesn't have to poll the update while it waits for them.
+ */
+class Echo_client
+{
+public:
+    Echo_client(const Net::Socket_options& options, Net::Connection_pipeline pipeline)
+    {
+        m_client.add_accepted_message(Message_id::echo);
+        m_client.set_socket_options(options);
+        m_client.set_connection_pipeline(pipeline);
+        m_client.set_message_dispatch(Net::Message_dispatch::direct);
+        m_client.m_on_notification.set_callback(print_error);
+        m_client.m_on_connected.set_callback([this] { m_is_connected = true; });
+        m_client.m_on_message.set_callback(
+            [this](const Net::Message<Message_id>&) { m_received_count.fetch_add(1, std::memory_order_release); });
+    }
+
+    // Throws if the server did not accept the client in time
+    void connect(const Echo_server& server)
+    {
+        server.connect(m_client);
+        wait_until_connected();
+    }
+
+    void send(const Net::Message<Message_id>& message)
+    {
+        m_client.send_message(message);
+    }
+
+    [[nodiscard]] size_t get_received_count() const noexcept
+    {
+        return m_received_count.load(std::memory_order_acquire);
+    }
+
+private:
+    // The server accept is handled in the update
+    void wait_until_connected()
+    {
+        const auto deadline = Clock::now() + std::chrono::seconds(5);
+
+        while (!m_is_connected)
+        {
+            if (Clock::now() > deadline)
+                throw std::runtime_error("Client could not connect to the benchmark server");
+
+            m_client.update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    Net::Client<Message_id> m_client;
+    bool m_is_connected = false;
+    std::atomic<size_t> m_received_count = 0;
+};
+
+[[nodiscard]] Net::Message<Message_id> create_message(size_t body_size)
+{
+    Net::Message<Message_id> message;
+    message.set_id(Message_id::echo);
+
+    const std::vector<char> body(body_size, 'x');
+    message.push_back_buffer(body.data(), body.size());
+    return message;
+}
+
+/**
+ *   Round trip latency of one message at a time with the socket options that affect it.
+ *   Without no delay the body waits for the ack of the header which shows up as the delayed ack time.
+ */
+void run_latency_benchmark(const Arguments& arguments)
+{
+    const size_t round_trips = arguments.get_number("round_trips", 1000);
+    const size_t warm_up_round_trips = round_trips / 10;
+    const Net::Message<Message_id> message = create_message(arguments.get_number("size", 64));
+    auto port = static_cast<uint16_t>(arguments.get_number("port", 45000));
+
+    Net::Socket_options no_delay;
+
+    Net::Socket_options nagle;
+    nagle.m_no_delay = false;
+
+    Net::Socket_options quick_ack;
+    quick_ack.m_quick_ack = true;
+
+    Net::Socket_options busy_poll;
+    busy_poll.m_busy_poll = std::chrono::microseconds(50);
+
+    const std::vector<std::pair<std::string_view, Net::Socket_options>> option_sets = {
+        {"no_delay", no_delay}, {"nagle", nagle}, {"quick_ack", quick_ack}, {"busy_poll", busy_poll}};
+
+    std::cout << "Round trip of " << message.body_size() << " byte messages over tcp in microseconds\n";
+
+    for (const auto& [name, options] : option_sets)
+    {
+        // The server is destroyed first so the client doesn't report the closed connection
+        Echo_client client(options, Net::Connection_pipeline::callbacks);
+        Echo_server server(Transport::tcp, port++, options, Net::Connection_pipeline::callbacks);
+        server.start();
+        client.connect(server);
+
+        std::vector<double> latencies;
+        latencies.reserve(round_trips);
+
+        for (size_t i = 0; i < warm_up_round_trips + round_trips; ++i)
+        {
+            const auto start_time = Clock::now();
+            client.send(message);
+
+            // Yields so the Asio threads get the core when there are fewer cores than threads
+            while (client.get_received_count() <= i)
+                std::this_thread::yield();
+
+            if (i >= warm_up_round_trips)
+                latencies.push_back(Microseconds(Clock::now() - start_time).count());
+        }
+
+        std::ranges::sort(latencies);
+        const double average = std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size();
+
+        std::cout << "  " << name << ": average " << average << " median " << latencies[latencies.size() / 2]
+                  << " p99 " << latencies[latencies.size() * 99 / 100] << " max " << latencies.back() << "\n";
+    }
+}
+
+// CPU time of all the threads of the process. Not std::clock since it measures the wall time with MSVC.
+[[nodiscard]] Microseconds get_process_cpu_time() noexcept
+{
+#if defined(_WIN32)
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time);
+
+    // The times are in 100 nanoseconds
+    auto to_microseconds = [](FILETIME time) {
+        return Microseconds((static_cast<uint64_t>(time.dwHighDateTime) << 32 | time.dwLowDateTime) / 10.0);
+    };
+
+    return to_microseconds(kernel_time) + to_microseconds(user_time);
+#else
+    timespec time = {};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return Microseconds(static_cast<double>(time.tv_sec) * 1e6 + static_cast<double>(time.tv_nsec) / 1e3);
+#endif
+}
+
+[[nodiscard]] std::string_view get_backend_name(Net::Io_backend backend) noexcept
+{
+    switch (backend)
+    {
+    case Net::Io_backend::io_uring:
+        return "io_uring";
+    case Net::Io_backend::epoll:
+        return "epoll";
+    default:
+        return "other";
+    }
+}
+
+// Throws if the echoes stop coming so a lost message doesn't hang the benchmark
+void wait_for_echoes(const std::vector<std::unique_ptr<Echo_client>>& clients, size_t messages_per_client)
+{
+    size_t received_count = 0;
+    auto progress_time = Clock::now();
+
+    while (received_count < clients.size() * messages_per_client)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        size_t new_received_count = 0;
+        for (const auto& client : clients)
+            new_received_count += client->get_received_count();
+
+        if (new_received_count != received_count)
+            progress_time = Clock::now();
+        else if (Clock::now() - progress_time > std::chrono::seconds(10))
+            throw std::runtime_error("Echoes stopped after " + std::to_string(received_count) + " messages");
+
+        received_count = new_received_count;
+    }
+}
+
+/**
+ *   Echoes of many clients that send at the same time. All the messages are sent before waiting for the echoes
+ *   so the queues and the batched writes are part of the measurement. The transports can be compared with
+ *   the transport argument and the backends by building with and without NET_USE_IO_URING.
+ *   The cpu time includes both the server and the clients so it shows the cost of the framework even when
+ *   the cores are not all busy.
+ */
+void run_throughput_benchmark(const Arguments& arguments)
+{
+    const size_t client_count = arguments.get_number("clients", 16);
+    const size_t messages_per_client = arguments.get_number("messages", 10000);
+    const Net::Message<Message_id> message = create_message(arguments.get_number("size", 64));
+    const auto port = static_cast<uint16_t>(arguments.get_number("port", 45000));
+    const std::string transport_name = arguments.get("transport", "tcp");
+    const std::string pipeline_name = arguments.get("pipeline", "callbacks");
+    const Net::Connection_pipeline pipeline = parse_pipeline(pipeline_name);
+    const Net::Socket_options options;
+
+    // The server is destroyed first so the clients don't report the closed connections
+    std::vector<std::unique_ptr<Echo_client>> clients;
+    Echo_server server(parse_transport(transport_name), port, options, pipeline);
+    server.start();
+
+    for (size_t i = 0; i < client_count; ++i)
+    {
+        clients.push_back(std::make_unique<Echo_client>(options, pipeline));
+        clients.back()->connect(server);
+    }
+
+    const auto start_time = Clock::now();
+    const Microseconds start_cpu_time = get_process_cpu_time();
+
+    for (size_t i = 0; i < messages_per_client; ++i)
+        for (const auto& client : clients)
+            client->send(message);
+
+    wait_for_echoes(clients, messages_per_client);
+
+    const std::chrono::duration<double> duration = Clock::now() - start_time;
+    const Microseconds cpu_time = get_process_cpu_time() - start_cpu_time;
+    const size_t message_count = client_count * messages_per_client;
+
+    std::cout << "Echo of " << message_count << " messages of " << message.body_size() << " bytes from "
+              << client_count << " clients over " << transport_name << " with " << get_backend_name(Net::IO_BACKEND)
+              << " and " << pipeline_name << "\n";
+    std::cout << "  " << duration.count() << " seconds, " << message_count / duration.count()
+              << " messages per second, " << cpu_time.count() / message_count << " cpu microseconds per message\n";
+}
+
+/**
+ *   Entities that move every tick and find the entities near them, like a game server does before sending
+ *   the updates. The queries of one tick are also done by going through all the entities for comparison.
+ */
+void run_grid_benchmark(const Arguments& arguments)
+{
+    constexpr float SPEED = 5.0f;
+
+    const auto entity_count = static_cast<uint32_t>(arguments.get_number("entities", 10000));
+    const size_t tick_count = arguments.get_number("ticks", 100);
+    const auto radius = static_cast<float>(arguments.get_number("radius", 50));
+    const auto world_size = static_cast<float>(arguments.get_number("world", 2000));
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> coordinate(0.0f, world_size);
+    std::uniform_real_distribution<float> step(-SPEED, SPEED);
+
+    Net::Interest_grid grid(radius);
+    std::vector<Net::Position> positions(entity_count);
+
+    for (uint32_t id = 0; id < entity_count; ++id)
+    {
+        positions[id] = {coordinate(random), coordinate(random)};
+        grid.set_position(id, positions[id]);
+    }
+
+    Microseconds move_time{};
+    Microseconds query_time{};
+    size_t found_count = 0;
+
+    for (size_t tick = 0; tick < tick_count; ++tick)
+    {
+        // The new positions are made before the timing so only the grid is measured
+        for (Net::Position& position : positions)
+        {
+            position.m_x = std::clamp(position.m_x + step(random), 0.0f, world_size);
+            position.m_y = std::clamp(position.m_y + step(random), 0.0f, world_size);
+        }
+
+        const auto start_time = Clock::now();
+
+        for (uint32_t id = 0; id < entity_count; ++id)
+            grid.set_position(id, positions[id]);
+
+        const auto moved_time = Clock::now();
+
+        for (const Net::Position& position : positions)
+            grid.for_each_near(position, radius, [&found_count]([[maybe_unused]] uint32_t id) { ++found_count; });
+
+        move_time += moved_time - start_time;
+        query_time += Clock::now() - moved_time;
+    }
+
+    const auto brute_force_start_time = Clock::now();
+    size_t brute_force_found_count = 0;
+
+    for (const Net::Position& position : positions)
+    {
+        for (const Net::Position& other : positions)
+        {
+            const float delta_x = other.m_x - position.m_x;
+            const float delta_y = other.m_y - position.m_y;
+            brute_force_found_count += delta_x * delta_x + delta_y * delta_y <= radius * radius;
+        }
+    }
+
+    const Microseconds brute_force_time = Clock::now() - brute_force_start_time;
+
+    std::cout << entity_count << " entities moving in " << world_size << " x " << world_size << " with radius "
+              << radius << ", milliseconds per tick\n";
+    std::cout << "  set_position of all: " << move_time.count() / 1000.0 / tick_count << "\n";
+    std::cout << "  for_each_near of all: " << query_time.count() / 1000.0 / tick_count << ", "
+              << static_cast<double>(found_count) / tick_count / entity_count << " entities found on average\n";
+    std::cout << "  brute force of all: " << brute_force_time.count() / 1000.0 << ", "
+              << static_cast<double>(brute_force_found_count) / entity_count << " entities found on average\n";
+}
+
+void print_usage()
+{
+    std::cout << "Usage: Network_benchmark <benchmark> [name=value ...]\n"
+                 "  latency round_trips=1000 size=64 port=45000\n"
+                 "      round trip of one message at a time with different socket options\n"
+                 "  throughput clients=16 messages=10000 size=64 port=45000 transport=tcp pipeline=callbacks\n"
+                 "      echoes of many clients that send all their messages at once\n"
+                 "      transport is tcp, local, loopback or shared_memory (Linux only)\n"
+                 "      pipeline is callbacks or coroutines\n"
+                 "  grid entities=10000 ticks=100 radius=50 world=2000\n"
+                 "      interest grid with entities that move and find the entities near them every tick\n";
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        print_usage();
+        return 1;
+    }
+
+    try
+    {
+        const std::string_view benchmark = argv[1];
+        const Arguments arguments(argc, argv);
+
+        if (benchmark == "latency")
+            run_latency_benchmark(arguments);
+        else if (benchmark == "throughput")
+            run_throughput_benchmark(arguments);
+        else if (benchmark == "grid")
+            run_grid_benchmark(arguments);
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+    catch (const std::exception& exception)
+    {
+        std::cout << "Exception: " << exception.what() << "\n";
+        return 1;
+    }
+}
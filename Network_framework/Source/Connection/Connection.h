@@ -1,11 +1,23 @@
 #pragma once
 
 #include "../Events/Delegate.h"
+#include "../Message/Message_converter.h"
+#include "../Message/Outgoing_message.h"
 #include "../Message/Owned_message.h"
 #include "../Sockets/Socket_interface.h"
 #include "../Utility/Common.h"
+#include "../Utility/Notification.h"
 #include "../Utility/Thread_safe_deque.h"
+#include "../Utility/Timer_wheel.h"
+#include "Connection_metrics.h"
+#include "Inbound_budget.h"
+#include "Session_state.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <list>
 #include <memory>
+#include <optional>
 #include <unordered_map>
 
 namespace Net
@@ -15,23 +27,48 @@ namespace Net
         uint32_t m_min = 0, m_max = 0;
     };
 
+    // Timeouts after which the connection gets disconnected. Zero timeout is disabled.
+    struct Connection_timeouts
+    {
+        Timer_wheel::Duration m_handshake = {}, m_read_idle = {}, m_write_stall = {};
+    };
+
+    // How the connection drives the socket
+    enum class Connection_pipeline : uint8_t
+    {
+        // Each socket completion continues the state machine
+        callbacks,
+
+        // One coroutine reads and other writes the messages
+        coroutines
+    };
+
     // Class that repesents remote net connection
     template <Id_concept Id_type>
-    class Connection
+    class Connection final : public Socket_handler
     {
     public:
         using Accepted_messages_ptr = std::shared_ptr<const std::unordered_map<Id_type, Message_limits>>;
         using End_points = Protocol::resolver::results_type;
 
         Connection(std::unique_ptr<Socket_interface> socket, uint32_t connection_id)
-            : m_id(connection_id), m_socket(std::move(socket))
+            : m_id(connection_id), m_socket(std::move(socket)), m_inbound_budget(std::make_shared<Inbound_budget>())
         {
+            update_client_information();
         }
 
         Connection(const Connection&) = delete;
         Connection(Connection&&) = delete;
 
-        ~Connection() = default;
+        ~Connection()
+        {
+            *m_is_alive = false;
+            keep_unsent_messages();
+            m_inbound_budget->cancel_wait(this);
+
+            if (m_shared_inbound_budget != nullptr)
+                m_shared_inbound_budget->cancel_wait(this);
+        }
 
         Connection& operator=(const Connection&) = delete;
         Connection& operator=(Connection&&) = delete;
@@ -41,20 +78,46 @@ namespace Net
         {
             if (is_connected())
             {
-                setup_callbacks_on_socket();
+                m_socket->set_handler(this);
+                m_is_client_side = handshake_type == Handshake_type::client;
+                setup_timers();
                 update_ip();
+                m_handshake_start_time = std::chrono::steady_clock::now();
+
+                if (m_pipeline == Connection_pipeline::coroutines)
+                {
+                    asio::co_spawn(m_socket->get_executor(), run_pipeline(handshake_type), asio::detached);
+                    return;
+                }
+
+                m_socket->post([this] {
+                    if (!m_has_done_handshake)
+                        arm_timer(m_handshake_timer, m_timeouts.m_handshake);
+                });
+
                 m_socket->async_handshake(handshake_type);
             }
         }
 
-        void disconnect(const std::string& reason = "", bool is_error = false)
+        // Disconnecting with a reason notifies it as an error
+        void disconnect(Notification_code reason = Notification_code::none, asio::error_code error = {})
         {
             if (is_connected())
             {
-                if (!reason.empty())
-                    m_on_notification.broadcast(reason, is_error ? Severity::error : Severity::notification);
+                if (reason != Notification_code::none)
+                {
+                    m_metrics.set_disconnect_reason(reason);
+                    notify(reason, Severity::error, error);
+                }
 
                 m_socket->disconnect();
+
+                // The waiting coroutines see that the connection is closed and finish
+                if (m_pipeline == Connection_pipeline::coroutines)
+                {
+                    wake_writer();
+                    resume_reading();
+                }
             }
         }
 
@@ -65,7 +128,7 @@ namespace Net
 
         [[nodiscard]] uint32_t get_id() const noexcept
         {
-            return m_id;
+            return m_id.load();
         }
 
         [[nodiscard]] std::string_view get_ip() const noexcept
@@ -73,11 +136,19 @@ namespace Net
             return m_ip;
         }
 
-        // This should always be called from the Asio thread
-        void send_message(Message<Id_type> message)
+        // Unspecified for the sockets that don't use ip
+        [[nodiscard]] asio::ip::address get_address() const
         {
+            return m_socket->get_address();
+        }
+
+        // Can be called from any thread since the writing is started in the Asio thread.
+        // Shared messages are written without copying them.
+        void send_message(Outgoing_message<Id_type> message)
+        {
+            m_metrics.count_queued(message_size(message.get()));
             m_out_queue.push_back(std::move(message));
-            start_writing_message();
+            wake_writer();
         }
 
         void set_accepted_messages(Accepted_messages_ptr accepted_messages) noexcept
@@ -85,17 +156,185 @@ namespace Net
             m_accepted_messages = accepted_messages;
         }
 
-        Delegate<const std::string&, Severity> m_on_notification;
+        // Sets limits for the received messages of this connection that have not been handled yet
+        void set_inbound_limits(Inbound_limits limits) noexcept
+        {
+            m_inbound_budget->set_limits(limits);
+        }
+
+        // Sets budget that is shared with other connections
+        void set_shared_inbound_budget(std::shared_ptr<Inbound_budget> budget) noexcept
+        {
+            m_shared_inbound_budget = std::move(budget);
+        }
+
+        // The budget that needs to be released when message from this connection has been handled
+        [[nodiscard]] const std::shared_ptr<Inbound_budget>& get_inbound_budget() const noexcept
+        {
+            return m_inbound_budget;
+        }
+
+        [[nodiscard]] bool is_reading_paused() const noexcept
+        {
+            return m_is_reading_paused;
+        }
+
+        // Should be set before the connection is started
+        void set_timer_wheel(Timer_wheel* timer_wheel, Connection_timeouts timeouts) noexcept
+        {
+            m_timer_wheel = timer_wheel;
+            m_timeouts = timeouts;
+        }
+
+        // Sets the options on the socket in the Asio thread
+        void set_socket_options(Socket_options options)
+        {
+            m_socket->post([this, options = std::move(options)] {
+                if (const asio::error_code error = m_socket->set_options(options))
+                    notify(Notification_code::socket_options_failed, Severity::error, error);
+            });
+        }
+
+        // How often the connection pings the remote. Zero disables pinging. Should be set before starting.
+        void set_ping_interval(Timer_wheel::Duration ping_interval) noexcept
+        {
+            m_ping_interval = ping_interval;
+        }
+
+        // Should be set before starting
+        void set_pipeline(Connection_pipeline pipeline) noexcept
+        {
+            m_pipeline = pipeline;
+        }
+
+        // Counts and keeps the messages so they can be replayed after reconnecting. Should be set before starting.
+        void set_session(std::shared_ptr<Session_state<Id_type>> session) noexcept
+        {
+            m_session = std::move(session);
+        }
+
+        /**
+         *   Asks the server to continue the earlier session of the client in this connection
+         *
+         *   @param the id that the client had in the session
+         *   @param the token that the server gave for the session
+         */
+        void request_session_resume(uint32_t client_id, uint64_t session_token)
+        {
+            m_socket->post([this, client_id, session_token] {
+                const uint64_t received_count = m_session != nullptr ? m_session->m_received_count : 0;
+
+                send_message(Message_converter<Id_type>::create_session_resume(
+                    {.m_session_token = session_token, .m_received_count = received_count, .m_client_id = client_id}));
+            });
+        }
+
+        /**
+         *   Continues the earlier session in this connection and replays the messages the client did not receive
+         *
+         *   @param the id of the client in the session
+         *   @param the session
+         *   @param how many messages the client received in the session
+         */
+        void resume_session(
+            uint32_t client_id, std::shared_ptr<Session_state<Id_type>> session, uint64_t remote_received_count)
+        {
+            m_id = client_id;
+
+            m_socket->post([this, client_id, session = std::move(session), remote_received_count]() mutable {
+                m_session = std::move(session);
+                update_client_information();
+
+                send_message(Message_converter<Id_type>::create_session_resumed(
+                    {.m_received_count = m_session->m_received_count, .m_client_id = client_id, .m_is_resumed = true}));
+                replay_session(remote_received_count);
+            });
+        }
+
+        // Tells the client that the session it asked for could not be resumed
+        void reject_session_resume()
+        {
+            m_socket->post([this] {
+                send_message(Message_converter<Id_type>::create_session_resumed(
+                    {.m_client_id = get_id(), .m_is_resumed = false}));
+            });
+        }
+
+        // Can be called from any thread
+        [[nodiscard]] Connection_metrics_snapshot<Id_type> get_metrics() const
+        {
+            Connection_metrics_snapshot<Id_type> snapshot = m_metrics.get_snapshot();
+            snapshot.m_client_id = get_id();
+            snapshot.m_in_queue = {m_inbound_budget->get_messages(), m_inbound_budget->get_bytes()};
+            return snapshot;
+        }
+
+        [[nodiscard]] Latency_information get_latency_information() const noexcept
+        {
+            using std::chrono::nanoseconds;
+
+            Latency_information information;
+            information.m_round_trip_time = nanoseconds(m_round_trip_time.load());
+            information.m_jitter = nanoseconds(m_jitter.load());
+            information.m_clock_offset = nanoseconds(m_clock_offset.load());
+            return information;
+        }
+
+        /**
+         *   Runs the task in the Asio thread after the delay unless the connection is destroyed before.
+         *   This should always be called from the Asio thread.
+         *
+         *   @param the delay
+         *   @param the task
+         */
+        void schedule_task(Timer_wheel::Duration delay, std::function<void()> task)
+        {
+            if (m_timer_wheel == nullptr)
+                return;
+
+            Timer_wheel::Timer& timer = m_tasks.emplace_front();
+            timer.m_on_expired.set_callback([this, task_it = m_tasks.begin(), task = std::move(task)]() mutable {
+                auto expired_task = std::move(task);
+                m_tasks.erase(task_it);
+                expired_task();
+            });
+
+            m_timer_wheel->schedule(timer, delay);
+        }
+
+        Delegate<const Notification&> m_on_notification;
         Delegate<Owned_message<Id_type>> m_on_message;
 
     private:
-        void setup_callbacks_on_socket()
+        // Template socket calls the completions directly
+        template <typename Asio_socket, typename Handler>
+        friend class Template_socket;
+
+        void setup_timers()
+        {
+            m_handshake_timer.m_on_expired.set_callback([this] { disconnect(Notification_code::handshake_timed_out); });
+            m_read_idle_timer.m_on_expired.set_callback([this] { disconnect(Notification_code::read_idle_timed_out); });
+            m_write_stall_timer.m_on_expired.set_callback([this] { disconnect(Notification_code::write_stalled); });
+            m_ping_timer.m_on_expired.set_callback([this] { send_ping(); });
+        }
+
+        // Nothing is formatted here. The user formats the notification only if it is needed.
+        void notify(Notification_code code, Severity severity, asio::error_code error = {})
         {
-            m_socket->m_handshake_finished.set_callback(this, &Connection<Id_type>::async_handshake_finished);
-            m_socket->m_read_header_finished.set_callback(this, &Connection<Id_type>::async_read_header_finished);
-            m_socket->m_read_body_finished.set_callback(this, &Connection<Id_type>::async_read_body_finished);
-            m_socket->m_write_header_finished.set_callback(this, &Connection<Id_type>::async_write_header_finished);
-            m_socket->m_write_body_finished.set_callback(this, &Connection<Id_type>::async_write_body_finished);
+            m_on_notification.broadcast({
+                .m_code = code,
+                .m_severity = severity,
+                .m_client_id = get_id(),
+                .m_address = get_address(),
+                .m_error = error,
+            });
+        }
+
+        // Arms the timer if there is timer wheel and the timeout is enabled
+        void arm_timer(Timer_wheel::Timer& timer, Timer_wheel::Duration timeout) noexcept
+        {
+            if (m_timer_wheel != nullptr && timeout > Timer_wheel::Duration::zero())
+                m_timer_wheel->schedule(timer, timeout);
         }
 
         // Updates m_ip member with the current remote ip
@@ -103,26 +342,51 @@ namespace Net
         {
             if (is_connected())
                 m_ip = m_socket->get_ip();
+
+            update_client_information();
+        }
+
+        // The received messages share this so they don't need to copy the ip
+        void update_client_information()
+        {
+            m_client_information = std::make_shared<const Client_information>(get_id(), m_ip);
         }
 
         // Events when handshake is finished
-        void async_handshake_finished(asio::error_code error)
+        void async_handshake_finished(asio::error_code error) override
         {
-            if (!error)
+            if (m_pipeline == Connection_pipeline::coroutines)
             {
-                m_has_done_handshake = true;
-
-                m_on_notification.broadcast(
-                    std::format("Succesfull handshake with {}", get_ip()), Severity::notification);
+                complete(m_read_completion, error);
+                return;
+            }
 
+            if (on_handshake_finished(error))
+            {
                 // Starts to wait messages
-                m_socket->async_read_header(m_received_message.header_data(), m_received_message.header_size());
+                start_reading_header();
 
                 // If received any messages to be sent during the handshake, we send them now
                 start_writing_message();
             }
-            else
-                disconnect(std::format("Error on handshake because {}", error.message()), true);
+        }
+
+        // Returns true if the handshake was successful
+        bool on_handshake_finished(asio::error_code error)
+        {
+            m_handshake_timer.cancel();
+
+            if (error)
+            {
+                disconnect(Notification_code::handshake_failed, error);
+                return false;
+            }
+
+            m_has_done_handshake = true;
+            m_metrics.set_handshake_duration(std::chrono::steady_clock::now() - m_handshake_start_time);
+            notify(Notification_code::handshake_succeeded, Severity::notification);
+            arm_timer(m_ping_timer, m_ping_interval);
+            return true;
         }
 
         // Checks if the header is in valid format
@@ -132,7 +396,10 @@ namespace Net
                 return false;
 
             if (header.m_internal_id != Internal_id::not_internal)
-                return true; // todo add spesific validation for internal messages
+            {
+                const size_t internal_body_size = Message_converter<Id_type>::internal_body_size(header.m_internal_id);
+                return internal_body_size != 0 && header.m_size == internal_body_size;
+            }
 
             if (m_accepted_messages != nullptr)
             {
@@ -149,13 +416,21 @@ namespace Net
         }
 
         // Event when read header is finished
-        void async_read_header_finished(asio::error_code error, [[maybe_unused]] size_t bytes)
+        void async_read_header_finished(asio::error_code error, [[maybe_unused]] size_t bytes) override
         {
+            if (m_pipeline == Connection_pipeline::coroutines)
+            {
+                complete(m_read_completion, error);
+                return;
+            }
+
             if (!error)
             {
+                arm_timer(m_read_idle_timer, m_timeouts.m_read_idle);
+
                 if (!validate_header(m_received_message.get_header()))
                 {
-                    disconnect("Header validation failed", true);
+                    disconnect(Notification_code::header_validation_failed);
                     return;
                 }
 
@@ -163,7 +438,7 @@ namespace Net
                 if (m_received_message.get_header().m_size == 0)
                 {
                     on_message_received();
-                    m_socket->async_read_header(m_received_message.header_data(), m_received_message.header_size());
+                    start_reading_header();
                     return;
                 }
 
@@ -171,24 +446,82 @@ namespace Net
                 m_socket->async_read_body(m_received_message.body_data(), m_received_message.body_size());
             }
             else
-                disconnect(std::format("Read header failed because {}", error.message()), true);
+                disconnect(Notification_code::read_header_failed, error);
         }
 
         // Event when read body is finished
-        void async_read_body_finished(asio::error_code error, [[maybe_unused]] size_t bytes)
+        void async_read_body_finished(asio::error_code error, [[maybe_unused]] size_t bytes) override
         {
+            if (m_pipeline == Connection_pipeline::coroutines)
+            {
+                complete(m_read_completion, error);
+                return;
+            }
+
             if (!error)
             {
+                arm_timer(m_read_idle_timer, m_timeouts.m_read_idle);
+
                 on_message_received();
-                m_socket->async_read_header(m_received_message.header_data(), m_received_message.header_size());
+                start_reading_header();
             }
             else
-                disconnect(std::format("Read body failed because {}", error.message()), true);
+                disconnect(Notification_code::read_body_failed, error);
+        }
+
+        /**
+         *   Starts reading the next header if the inbound budgets allow it.
+         *   Otherwise pauses reading so the TCP flow control pushes back on the sender.
+         */
+        void start_reading_header()
+        {
+            if (!is_connected() || pause_reading_if_exceeded())
+                return;
+
+            m_socket->async_read_header(m_received_message.header_data(), m_received_message.header_size());
+        }
+
+        // Returns true if reading was paused because an inbound budget is exceeded
+        bool pause_reading_if_exceeded()
+        {
+            for (Inbound_budget* budget : {m_inbound_budget.get(), m_shared_inbound_budget.get()})
+            {
+                if (budget != nullptr && budget->is_exceeded() && budget->wait(this, [this] { resume_reading(); }))
+                {
+                    // Not reading is not the remote's fault
+                    m_read_idle_timer.cancel();
+                    m_is_reading_paused = true;
+                    return true;
+                }
+            }
+
+            if (m_is_reading_paused || !m_read_idle_timer.is_armed())
+                arm_timer(m_read_idle_timer, m_timeouts.m_read_idle);
+
+            m_is_reading_paused = false;
+            return false;
+        }
+
+        // Called from the thread that released the budget
+        void resume_reading()
+        {
+            m_socket->post([this, is_alive = m_is_alive] {
+                if (!*is_alive)
+                    return;
+
+                if (m_pipeline == Connection_pipeline::callbacks)
+                    start_reading_header();
+                else if (m_is_reader_waiting)
+                {
+                    m_is_reader_waiting = false;
+                    complete(m_read_completion, asio::error_code());
+                }
+            });
         }
 
         const Message<Id_type>& out_message() noexcept
         {
-            return m_out_queue.front();
+            return m_out_queue.front().get();
         }
 
         // Starts writing message if possible otherwise does nothing
@@ -197,66 +530,528 @@ namespace Net
             if (!m_out_queue.empty() && !m_is_writing_message && m_has_done_handshake)
             {
                 m_is_writing_message = true;
+                arm_timer(m_write_stall_timer, m_timeouts.m_write_stall);
                 m_socket->async_write_header(out_message().header_data(), out_message().header_size());
             }
         }
 
+        // Pops the written message and starts writing the next one if there is any
+        void write_next_message()
+        {
+            pop_written_message();
+
+            if (!m_out_queue.empty())
+            {
+                arm_timer(m_write_stall_timer, m_timeouts.m_write_stall);
+                m_socket->async_write_header(out_message().header_data(), out_message().header_size());
+            }
+            else
+            {
+                m_write_stall_timer.cancel();
+                m_is_writing_message = false;
+            }
+        }
+
         // Event when write header is finished
-        void async_write_header_finished(asio::error_code error, [[maybe_unused]] size_t bytes)
+        void async_write_header_finished(asio::error_code error, [[maybe_unused]] size_t bytes) override
         {
+            if (m_pipeline == Connection_pipeline::coroutines)
+            {
+                complete(m_write_completion, error);
+                return;
+            }
+
             if (!error)
             {
                 if (out_message().get_header().m_size > 0)
                     m_socket->async_write_body(out_message().body_data(), out_message().body_size());
 
                 else
-                {
-                    m_out_queue.pop_front();
-
-                    if (!m_out_queue.empty())
-                        m_socket->async_write_header(out_message().header_data(), out_message().header_size());
-                    else
-                        m_is_writing_message = false;
-                }
+                    write_next_message();
             }
             else
-                disconnect(std::format("Write header failed because {}", error.message()), true);
+                disconnect(Notification_code::write_header_failed, error);
         }
 
         // Event when writing to body is finished
-        void async_write_body_finished(asio::error_code error, [[maybe_unused]] size_t bytes)
+        void async_write_body_finished(asio::error_code error, [[maybe_unused]] size_t bytes) override
         {
+            if (m_pipeline == Connection_pipeline::coroutines)
+            {
+                complete(m_write_completion, error);
+                return;
+            }
+
             if (!error)
+                write_next_message();
+            else
+                disconnect(Notification_code::write_body_failed, error);
+        }
+
+        // Socket operation or event that the coroutine waits for. The completion resumes the coroutine directly.
+        struct Awaited_completion
+        {
+            using Handler = asio::async_result<asio::use_awaitable_t<>, void()>::handler_type;
+
+            std::optional<Handler> m_handler;
+            asio::error_code m_error;
+
+            // Completions that happen while the operation is being started are resumed after it
+            bool m_is_starting = false;
+            bool m_is_done = false;
+        };
+
+        // Resumes the coroutine waiting for the completion. Does nothing if no coroutine is waiting.
+        static void complete(Awaited_completion& completion, asio::error_code error)
+        {
+            completion.m_error = error;
+            completion.m_is_done = true;
+
+            if (!completion.m_handler.has_value() || completion.m_is_starting)
+                return;
+
+            typename Awaited_completion::Handler handler = std::move(completion.m_handler.value());
+            completion.m_handler.reset();
+            handler();
+        }
+
+        /**
+         *   Starts the operation when the coroutine has suspended and resumes it when the operation completes.
+         *   If the connection is destroyed during the wait, the coroutine is destroyed without resuming it.
+         *
+         *   @param the completion the operation completes. Its error is the error of the operation.
+         *   @param starts the operation
+         */
+        template <typename Start_operation>
+        [[nodiscard]] auto await_completion(Awaited_completion& completion, Start_operation start_operation)
+        {
+            return asio::async_initiate<const asio::use_awaitable_t<>&, void()>(
+                [this, &completion, start_operation](typename Awaited_completion::Handler handler) {
+                    completion.m_handler.emplace(std::move(handler));
+                    completion.m_is_done = false;
+                    completion.m_is_starting = true;
+                    start_operation();
+                    completion.m_is_starting = false;
+
+                    // Resuming inside the start would run the coroutine in the middle of its own suspension
+                    if (completion.m_is_done)
+                    {
+                        m_socket->post([this, &completion, is_alive = m_is_alive] {
+                            if (*is_alive)
+                                complete(completion, completion.m_error);
+                        });
+                    }
+                },
+                asio::use_awaitable);
+        }
+
+        // Does the handshake and then runs the reader and the writer coroutines
+        asio::awaitable<void> run_pipeline(Handshake_type handshake_type)
+        {
+            if (!m_has_done_handshake)
+                arm_timer(m_handshake_timer, m_timeouts.m_handshake);
+
+            co_await await_completion(
+                m_read_completion, [this, handshake_type] { m_socket->async_handshake(handshake_type); });
+
+            if (!on_handshake_finished(m_read_completion.m_error))
+                co_return;
+
+            asio::co_spawn(m_socket->get_executor(), write_messages(), asio::detached);
+            co_await read_messages();
+        }
+
+        asio::awaitable<void> read_messages()
+        {
+            while (is_connected())
+            {
+                if (pause_reading_if_exceeded())
+                {
+                    m_is_reader_waiting = true;
+                    co_await await_completion(m_read_completion, [] {});
+                    continue;
+                }
+
+                co_await await_completion(m_read_completion, [this] {
+                    m_socket->async_read_header(m_received_message.header_data(), m_received_message.header_size());
+                });
+
+                if (m_read_completion.m_error)
+                {
+                    disconnect(Notification_code::read_header_failed, m_read_completion.m_error);
+                    co_return;
+                }
+
+                arm_timer(m_read_idle_timer, m_timeouts.m_read_idle);
+
+                if (!validate_header(m_received_message.get_header()))
+                {
+                    disconnect(Notification_code::header_validation_failed);
+                    co_return;
+                }
+
+                if (m_received_message.get_header().m_size > 0)
+                {
+                    m_received_message.resize_body(m_received_message.get_header().m_size);
+
+                    co_await await_completion(m_read_completion, [this] {
+                        m_socket->async_read_body(m_received_message.body_data(), m_received_message.body_size());
+                    });
+
+                    if (m_read_completion.m_error)
+                    {
+                        disconnect(Notification_code::read_body_failed, m_read_completion.m_error);
+                        co_return;
+                    }
+
+                    arm_timer(m_read_idle_timer, m_timeouts.m_read_idle);
+                }
+
+                on_message_received();
+            }
+        }
+
+        // Writes the queued messages and waits for more when the queue is empty
+        asio::awaitable<void> write_messages()
+        {
+            while (is_connected())
             {
-                m_out_queue.pop_front();
+                if (m_out_queue.empty())
+                {
+                    m_write_stall_timer.cancel();
+                    m_is_writer_waiting = true;
+                    co_await await_completion(m_write_completion, [] {});
+                    continue;
+                }
 
-                if (!m_out_queue.empty())
+                arm_timer(m_write_stall_timer, m_timeouts.m_write_stall);
+
+                co_await await_completion(m_write_completion, [this] {
                     m_socket->async_write_header(out_message().header_data(), out_message().header_size());
-                else
-                    m_is_writing_message = false;
+                });
+
+                if (m_write_completion.m_error)
+                {
+                    disconnect(Notification_code::write_header_failed, m_write_completion.m_error);
+                    co_return;
+                }
+
+                if (out_message().get_header().m_size > 0)
+                {
+                    co_await await_completion(m_write_completion, [this] {
+                        m_socket->async_write_body(out_message().body_data(), out_message().body_size());
+                    });
+
+                    if (m_write_completion.m_error)
+                    {
+                        disconnect(Notification_code::write_body_failed, m_write_completion.m_error);
+                        co_return;
+                    }
+                }
+
+                pop_written_message();
             }
+
+            m_write_stall_timer.cancel();
+        }
+
+        // Keeps the written message for the replay until the remote acknowledges it
+        void pop_written_message()
+        {
+            Outgoing_message<Id_type> message = m_out_queue.pop_front();
+
+            const Message<Id_type>& written_message = message.get();
+            const size_t size = message_size(written_message);
+            m_metrics.count_dequeued(size);
+            m_metrics.count_sent(
+                written_message.get_id(), written_message.get_internal_id() != Internal_id::not_internal, size);
+
+            if (m_session != nullptr && Session_state<Id_type>::is_replayed(message.get().get_internal_id()))
+            {
+                m_session->m_unacked.push_back(std::move(message));
+                ++m_session->m_sent_count;
+            }
+        }
+
+        // Moves the messages that were not written to the session so the next connection can write them
+        void keep_unsent_messages()
+        {
+            if (m_session == nullptr)
+                return;
+
+            while (!m_out_queue.empty())
+            {
+                Outgoing_message<Id_type> message = m_out_queue.pop_front();
+                m_metrics.count_dequeued(message_size(message.get()));
+
+                if (Session_state<Id_type>::is_replayed(message.get().get_internal_id()))
+                    m_session->m_unsent.push_back(std::move(message));
+            }
+        }
+
+        // Writes again the messages that the remote did not receive before the earlier connection was lost
+        void replay_session(uint64_t remote_received_count)
+        {
+            m_session->acknowledge(remote_received_count);
+            m_session->m_sent_count -= m_session->m_unacked.size();
+
+            for (auto* messages : {&m_session->m_unacked, &m_session->m_unsent})
+            {
+                for (Outgoing_message<Id_type>& message : *messages)
+                    send_message(std::move(message));
+
+                messages->clear();
+            }
+        }
+
+        void send_ack()
+        {
+            m_session->m_acked_received_count = m_session->m_received_count;
+            send_message(Message_converter<Id_type>::create_ack({.m_received_count = m_session->m_received_count}));
+        }
+
+        void on_ack_received()
+        {
+            const Ack_data ack = Message_converter<Id_type>::extract_ack(m_received_message);
+
+            if (m_session != nullptr)
+                m_session->acknowledge(ack.m_received_count);
+        }
+
+        /**
+         *   Keeps the session only if the server keeps it too. Otherwise nothing would acknowledge the kept messages.
+         *   A client without its own session still acks so the server can drop the messages it keeps for replaying.
+         *   The message is also given to the client.
+         */
+        void on_server_accept_received()
+        {
+            if (!m_is_client_side)
+                return;
+
+            Message<Id_type> message = m_received_message;
+            const Server_data data = Message_converter<Id_type>::extract_server_accept(message);
+
+            if (data.m_session_token == 0 && m_session != nullptr)
+            {
+                *m_session = Session_state<Id_type>();
+                m_session = nullptr;
+            }
+            else if (data.m_session_token != 0 && m_session == nullptr)
+                m_session = std::make_shared<Session_state<Id_type>>();
+        }
+
+        // The server answered to the resume request. The message is also given to the client.
+        void on_session_resumed()
+        {
+            if (m_session == nullptr)
+                return;
+
+            Message<Id_type> message = m_received_message;
+            const Session_resumed_data data = Message_converter<Id_type>::extract_session_resumed(message);
+
+            if (data.m_is_resumed)
+                replay_session(data.m_received_count);
             else
-                disconnect(std::format("Write body failed because {}", error.message()), true);
+                *m_session = Session_state<Id_type>();
+        }
+
+        /**
+         *   Starts writing the queued messages in the Asio thread, or wakes up the writer coroutine if it is waiting
+         *   for them. Only one wake up is posted at a time and it writes everything that was queued before it ran.
+         */
+        void wake_writer()
+        {
+            if (m_is_writer_wake_pending.exchange(true, std::memory_order_acq_rel))
+                return;
+
+            m_socket->post([this, is_alive = m_is_alive] {
+                if (!*is_alive)
+                    return;
+
+                // Exchanged instead of stored so the messages queued before the flag was set are seen below
+                m_is_writer_wake_pending.exchange(false, std::memory_order_acq_rel);
+
+                if (m_pipeline == Connection_pipeline::callbacks)
+                    start_writing_message();
+                else if (m_is_writer_waiting)
+                {
+                    m_is_writer_waiting = false;
+                    complete(m_write_completion, asio::error_code());
+                }
+            });
+        }
+
+        // Nanoseconds since the epoch of the system clock
+        [[nodiscard]] static int64_t system_time_now() noexcept
+        {
+            using namespace std::chrono;
+            return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+        }
+
+        void send_ping()
+        {
+            if (!is_connected())
+                return;
+
+            send_message(Message_converter<Id_type>::create_ping({.m_send_time = system_time_now()}));
+            arm_timer(m_ping_timer, m_ping_interval);
+
+            if (m_session != nullptr && m_session->m_received_count != m_session->m_acked_received_count)
+                send_ack();
+        }
+
+        // Answers to the ping straight from the Asio thread
+        void on_ping_received(int64_t receive_time)
+        {
+            const Ping_data ping = Message_converter<Id_type>::extract_ping(m_received_message);
+
+            const Pong_data pong = {
+                .m_ping_send_time = ping.m_send_time,
+                .m_ping_receive_time = receive_time,
+                .m_send_time = system_time_now()};
+            send_message(Message_converter<Id_type>::create_pong(pong));
+        }
+
+        // Updates the latency with NTP style calculation
+        void on_pong_received(int64_t receive_time)
+        {
+            const Pong_data pong = Message_converter<Id_type>::extract_pong(m_received_message);
+
+            const int64_t remote_processing_time = pong.m_send_time - pong.m_ping_receive_time;
+            const int64_t total_time = receive_time - pong.m_ping_send_time;
+            const int64_t round_trip_time = std::max<int64_t>(total_time - remote_processing_time, 0);
+            const int64_t clock_offset =
+                ((pong.m_ping_receive_time - pong.m_ping_send_time) + (pong.m_send_time - receive_time)) / 2;
+
+            // Smoothing is done same way as in TCP retransmission timer calculation
+            if (!m_has_received_pong)
+            {
+                m_has_received_pong = true;
+                m_round_trip_time = round_trip_time;
+                m_jitter = round_trip_time / 2;
+                m_clock_offset = clock_offset;
+                return;
+            }
+
+            const int64_t smoothed_round_trip_time = m_round_trip_time;
+            m_jitter = m_jitter + (std::abs(smoothed_round_trip_time - round_trip_time) - m_jitter) / 4;
+            m_round_trip_time = smoothed_round_trip_time + (round_trip_time - smoothed_round_trip_time) / 8;
+            m_clock_offset = m_clock_offset + (clock_offset - m_clock_offset) / 8;
+        }
+
+        // Handles the messages that are internal to the connection. Returns true if the message was handled.
+        bool handle_connection_message()
+        {
+            switch (m_received_message.get_internal_id())
+            {
+            case Internal_id::ping:
+                on_ping_received(system_time_now());
+                break;
+            case Internal_id::pong:
+                on_pong_received(system_time_now());
+                break;
+            case Internal_id::ack:
+                on_ack_received();
+                break;
+            case Internal_id::server_accept:
+                on_server_accept_received();
+                return false;
+            case Internal_id::session_resumed:
+                on_session_resumed();
+                return false;
+            default:
+                return false;
+            }
+
+            m_received_message = Message<Id_type>();
+            return true;
+        }
+
+        [[nodiscard]] static size_t message_size(const Message<Id_type>& message) noexcept
+        {
+            return message.header_size() + message.body_size();
         }
 
         // Triggers on_message callback on current reveived_message
         void on_message_received()
         {
-            auto owned_message =
-                Owned_message<Id_type>(std::move(m_received_message), Client_information(get_id(), get_ip()));
+            m_metrics.count_received(
+                m_received_message.get_id(),
+                m_received_message.get_internal_id() != Internal_id::not_internal,
+                message_size(m_received_message));
+
+            if (handle_connection_message())
+                return;
+
+            if (m_session != nullptr && Session_state<Id_type>::is_replayed(m_received_message.get_internal_id()))
+            {
+                ++m_session->m_received_count;
+
+                if (m_session->should_ack())
+                    send_ack();
+            }
+
+            const size_t size = message_size(m_received_message);
+            m_inbound_budget->consume(size);
+
+            if (m_shared_inbound_budget != nullptr)
+                m_shared_inbound_budget->consume(size);
+
+            auto owned_message = Owned_message<Id_type>(std::move(m_received_message), m_client_information);
             m_on_message.broadcast(std::move(owned_message));
             m_received_message = Message<Id_type>();
         }
 
-        const uint32_t m_id = 0;
+        // Changes when the connection continues an earlier session
+        std::atomic<uint32_t> m_id = 0;
         std::string m_ip = "0.0.0.0";
 
+        // Sender of the received messages. Only used from the Asio thread after the connection has started.
+        std::shared_ptr<const Client_information> m_client_information;
+
         std::unique_ptr<Socket_interface> m_socket;
         bool m_has_done_handshake = false;
+        bool m_is_client_side = false;
+
+        // Coroutine pipeline state. The posted wake ups check the alive flag before resuming the coroutines.
+        Connection_pipeline m_pipeline = Connection_pipeline::callbacks;
+        std::shared_ptr<bool> m_is_alive = std::make_shared<bool>(true);
+        Awaited_completion m_read_completion;
+        Awaited_completion m_write_completion;
+        bool m_is_reader_waiting = false;
+        bool m_is_writer_waiting = false;
 
+        // Writing state is only used from the Asio thread. The other threads queue the messages and post a wake up.
         bool m_is_writing_message = false;
+        std::atomic<bool> m_is_writer_wake_pending = false;
         Message<Id_type> m_received_message;
-        Thread_safe_deque<Message<Id_type>> m_out_queue;
+        Thread_safe_deque<Outgoing_message<Id_type>> m_out_queue;
         Accepted_messages_ptr m_accepted_messages = nullptr;
+
+        std::shared_ptr<Inbound_budget> m_inbound_budget;
+        std::shared_ptr<Inbound_budget> m_shared_inbound_budget = nullptr;
+        std::atomic<bool> m_is_reading_paused = false;
+
+        // Only used from the Asio thread after the connection has started
+        std::shared_ptr<Session_state<Id_type>> m_session = nullptr;
+
+        Timer_wheel* m_timer_wheel = nullptr;
+        Connection_timeouts m_timeouts;
+        Timer_wheel::Timer m_handshake_timer;
+        Timer_wheel::Timer m_read_idle_timer;
+        Timer_wheel::Timer m_write_stall_timer;
+        std::list<Timer_wheel::Timer> m_tasks;
+
+        Timer_wheel::Duration m_ping_interval = {};
+        Timer_wheel::Timer m_ping_timer;
+
+        // Latency in nanoseconds. Written in the Asio thread.
+        bool m_has_received_pong = false;
+        std::atomic<int64_t> m_round_trip_time = 0;
+        std::atomic<int64_t> m_jitter = 0;
+        std::atomic<int64_t> m_clock_offset = 0;
+
+        Connection_metrics<Id_type> m_metrics;
+        std::chrono::steady_clock::time_point m_handshake_start_time;
     };
 } // namespace Net
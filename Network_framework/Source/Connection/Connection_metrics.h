@@ -0,0 +1,188 @@
+#pragma once
+
+#include "../Message/Message_header.h"
+#include "../Utility/Notification.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace Net
+{
+    // Messages and their bytes including the headers
+    struct Traffic
+    {
+        uint64_t m_messages = 0;
+        uint64_t m_bytes = 0;
+    };
+
+    template <Id_concept Id_type>
+    struct Message_id_traffic
+    {
+        Id_type m_id = {};
+        Traffic m_received;
+        Traffic m_sent;
+    };
+
+    // Counters of one connection when the snapshot was taken
+    template <Id_concept Id_type>
+    struct Connection_metrics_snapshot
+    {
+        uint32_t m_client_id = 0;
+        Traffic m_received;
+        Traffic m_sent;
+
+        // Messages waiting to be written
+        Traffic m_out_queue;
+
+        // Received messages that have not been handled yet
+        Traffic m_in_queue;
+
+        // Zero until the handshake has succeeded
+        std::chrono::nanoseconds m_handshake_duration = {};
+
+        // None if the connection is still connected or it was disconnected by this side without an error
+        Notification_code m_disconnect_reason = Notification_code::none;
+
+        // Only the messages that are not internal to the framework. Internal messages are only in the totals.
+        std::vector<Message_id_traffic<Id_type>> m_message_ids;
+    };
+
+    /**
+     *   Counters of the connection. Only the Asio thread writes them except the out queue counters
+     *   so the counting is plain relaxed loads and stores. Snapshot can be taken from any thread.
+     */
+    template <Id_concept Id_type>
+    class Connection_metrics
+    {
+    public:
+        // How many different message ids are counted separately. The rest are only in the totals.
+        static constexpr size_t MAX_MESSAGE_IDS = 32;
+
+        // Called from the Asio thread
+        void count_received(Id_type id, bool is_internal, size_t bytes) noexcept
+        {
+            m_received.add(bytes);
+
+            if (Id_slot* slot = is_internal ? nullptr : find_slot(id))
+                slot->m_received.add(bytes);
+        }
+
+        // Called from the Asio thread when the message has been written
+        void count_sent(Id_type id, bool is_internal, size_t bytes) noexcept
+        {
+            m_sent.add(bytes);
+
+            if (Id_slot* slot = is_internal ? nullptr : find_slot(id))
+                slot->m_sent.add(bytes);
+        }
+
+        // The messages are queued from the thread calling update and from the Asio thread
+        void count_queued(size_t bytes) noexcept
+        {
+            m_out_queue_messages.fetch_add(1, std::memory_order_relaxed);
+            m_out_queue_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        void count_dequeued(size_t bytes) noexcept
+        {
+            m_out_queue_messages.fetch_sub(1, std::memory_order_relaxed);
+            m_out_queue_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+
+        void set_handshake_duration(std::chrono::nanoseconds duration) noexcept
+        {
+            m_handshake_duration.store(duration.count(), std::memory_order_relaxed);
+        }
+
+        // Keeps the first reason since the later errors are caused by it
+        void set_disconnect_reason(Notification_code reason) noexcept
+        {
+            Notification_code expected = Notification_code::none;
+            m_disconnect_reason.compare_exchange_strong(expected, reason, std::memory_order_relaxed);
+        }
+
+        // Counters can change while the snapshot is taken so they might not match each other exactly
+        [[nodiscard]] Connection_metrics_snapshot<Id_type> get_snapshot() const
+        {
+            Connection_metrics_snapshot<Id_type> snapshot;
+            snapshot.m_received = m_received.load();
+            snapshot.m_sent = m_sent.load();
+            snapshot.m_out_queue.m_messages = m_out_queue_messages.load(std::memory_order_relaxed);
+            snapshot.m_out_queue.m_bytes = m_out_queue_bytes.load(std::memory_order_relaxed);
+
+            const int64_t handshake_duration = m_handshake_duration.load(std::memory_order_relaxed);
+            snapshot.m_handshake_duration = std::chrono::nanoseconds(handshake_duration);
+            snapshot.m_disconnect_reason = m_disconnect_reason.load(std::memory_order_relaxed);
+
+            for (const Id_slot& slot : m_id_slots)
+            {
+                if (slot.m_is_used.load(std::memory_order_acquire))
+                    snapshot.m_message_ids.push_back({slot.m_id, slot.m_received.load(), slot.m_sent.load()});
+            }
+
+            return snapshot;
+        }
+
+    private:
+        // Has only one writer so adding doesn't need a locked instruction
+        struct Atomic_traffic
+        {
+            void add(size_t bytes) noexcept
+            {
+                m_messages.store(m_messages.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                m_bytes.store(m_bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+            }
+
+            [[nodiscard]] Traffic load() const noexcept
+            {
+                return {m_messages.load(std::memory_order_relaxed), m_bytes.load(std::memory_order_relaxed)};
+            }
+
+            std::atomic<uint64_t> m_messages = 0;
+            std::atomic<uint64_t> m_bytes = 0;
+        };
+
+        // The id is written before the slot is marked used so the readers see it
+        struct Id_slot
+        {
+            std::atomic<bool> m_is_used = false;
+            Id_type m_id = {};
+            Atomic_traffic m_received;
+            Atomic_traffic m_sent;
+        };
+
+        // Open addressing by the id. Returns nullptr if all the slots are used by other ids.
+        Id_slot* find_slot(Id_type id) noexcept
+        {
+            const auto id_value = static_cast<std::make_unsigned_t<std::underlying_type_t<Id_type>>>(id);
+
+            for (size_t i = 0; i < MAX_MESSAGE_IDS; ++i)
+            {
+                Id_slot& slot = m_id_slots[(id_value + i) % MAX_MESSAGE_IDS];
+
+                if (!slot.m_is_used.load(std::memory_order_relaxed))
+                {
+                    slot.m_id = id;
+                    slot.m_is_used.store(true, std::memory_order_release);
+                    return &slot;
+                }
+
+                if (slot.m_id == id)
+                    return &slot;
+            }
+
+            return nullptr;
+        }
+
+        Atomic_traffic m_received;
+        Atomic_traffic m_sent;
+        std::atomic<uint64_t> m_out_queue_messages = 0;
+        std::atomic<uint64_t> m_out_queue_bytes = 0;
+        std::atomic<int64_t> m_handshake_duration = 0;
+        std::atomic<Notification_code> m_disconnect_reason = Notification_code::none;
+        std::array<Id_slot, MAX_MESSAGE_IDS> m_id_slots;
+    };
+} // namespace Net
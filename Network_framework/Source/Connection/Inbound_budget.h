@@ -0,0 +1,163 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Limits for the received messages that are waiting to be handled.
+     *   Reading is paused when either max is reached and resumed when both are below the resume values.
+     *   Resume value of 0 means half of the max.
+     */
+    struct Inbound_limits
+    {
+        size_t m_max_messages = SIZE_T_MAX, m_max_bytes = SIZE_T_MAX;
+        size_t m_resume_messages = 0, m_resume_bytes = 0;
+    };
+
+    /**
+     *   Keeps count of the received messages that have not been handled yet.
+     *   Consumed from the Asio thread and released from the thread calling update.
+     */
+    class Inbound_budget
+    {
+    public:
+        explicit Inbound_budget(Inbound_limits limits = {}) noexcept : m_limits(limits)
+        {
+        }
+
+        Inbound_budget(const Inbound_budget&) = delete;
+        Inbound_budget(Inbound_budget&&) = delete;
+
+        ~Inbound_budget() = default;
+
+        Inbound_budget& operator=(const Inbound_budget&) = delete;
+        Inbound_budget& operator=(Inbound_budget&&) = delete;
+
+        // Should be set before any messages are received
+        void set_limits(Inbound_limits limits) noexcept
+        {
+            m_limits = limits;
+        }
+
+        [[nodiscard]] Inbound_limits get_limits() const noexcept
+        {
+            return m_limits;
+        }
+
+        void consume(size_t bytes) noexcept
+        {
+            m_messages.fetch_add(1);
+            m_bytes.fetch_add(bytes);
+        }
+
+        // Releases the consumed message and wakes up the waiters if we went below the resume values.
+        // Counts are changed before checking for waiters and wait does the opposite so one sees the other.
+        void release(size_t bytes)
+        {
+            m_messages.fetch_sub(1);
+            m_bytes.fetch_sub(bytes);
+
+            if (m_has_waiters && can_resume())
+                wake_waiters();
+        }
+
+        [[nodiscard]] bool is_exceeded() const noexcept
+        {
+            return m_messages >= m_limits.m_max_messages || m_bytes >= m_limits.m_max_bytes;
+        }
+
+        [[nodiscard]] size_t get_messages() const noexcept
+        {
+            return m_messages;
+        }
+
+        [[nodiscard]] size_t get_bytes() const noexcept
+        {
+            return m_bytes;
+        }
+
+        /**
+         *   Registers callback that gets called once when the usage drops below the resume values.
+         *   The callback is called from the thread that released the budget.
+         *
+         *   @param the owner of the callback so it can be cancelled later
+         *   @param the callback
+         *   @return false if the usage was already below the resume values and nothing was registered
+         */
+        bool wait(const void* owner, std::function<void()> on_resume)
+        {
+            std::scoped_lock lock(m_mutex);
+
+            if (can_resume())
+                return false;
+
+            // Marked before checking again so the release that happens in between sees the waiter and wakes it
+            m_waiters.emplace_back(owner, std::move(on_resume));
+            m_has_waiters = true;
+
+            if (can_resume())
+            {
+                m_waiters.pop_back();
+                m_has_waiters = !m_waiters.empty();
+                return false;
+            }
+
+            return true;
+        }
+
+        // Removes callbacks registered by the owner
+        void cancel_wait(const void* owner)
+        {
+            std::scoped_lock lock(m_mutex);
+
+            std::erase_if(m_waiters, [owner](const Waiter& waiter) { return waiter.first == owner; });
+            m_has_waiters = !m_waiters.empty();
+        }
+
+    private:
+        using Waiter = std::pair<const void*, std::function<void()>>;
+
+        [[nodiscard]] static size_t resume_value(size_t max, size_t resume) noexcept
+        {
+            return resume == 0 ? max / 2 : resume;
+        }
+
+        [[nodiscard]] bool can_resume() const noexcept
+        {
+            return m_messages < resume_value(m_limits.m_max_messages, m_limits.m_resume_messages) &&
+                   m_bytes < resume_value(m_limits.m_max_bytes, m_limits.m_resume_bytes);
+        }
+
+        void wake_waiters()
+        {
+            std::vector<Waiter> waiters;
+
+            {
+                std::scoped_lock lock(m_mutex);
+
+                if (!can_resume())
+                    return;
+
+                waiters.swap(m_waiters);
+                m_has_waiters = false;
+            }
+
+            for (auto& waiter : waiters)
+                waiter.second();
+        }
+
+        Inbound_limits m_limits;
+
+        std::atomic<size_t> m_messages = 0;
+        std::atomic<size_t> m_bytes = 0;
+
+        std::mutex m_mutex;
+        std::atomic<bool> m_has_waiters = false;
+        std::vector<Waiter> m_waiters;
+    };
+} // namespace Net
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "../Message/Outgoing_message.h"
+#include <cstdint>
+#include <deque>
+
+namespace Net
+{
+    /**
+     *   Messages of the session that the remote might not have received. Outlives the connections so the messages
+     *   can be replayed to the next connection of the session. Internal messages are not counted except subscriptions.
+     *   This should always be used from the Asio thread.
+     */
+    template <Id_concept Id_type>
+    struct Session_state
+    {
+        // Acks are sent after this many received messages and with the pings
+        static constexpr uint64_t ACK_INTERVAL = 32;
+
+        // Written messages that the remote has not acknowledged yet. Front is the oldest.
+        std::deque<Outgoing_message<Id_type>> m_unacked;
+
+        // Messages that were not written before the connection was lost
+        std::deque<Outgoing_message<Id_type>> m_unsent;
+
+        uint64_t m_sent_count = 0;
+        uint64_t m_received_count = 0;
+        uint64_t m_acked_received_count = 0;
+
+        // The messages that are counted and replayed. Subscriptions are replayed so they are not lost.
+        [[nodiscard]] static constexpr bool is_replayed(Internal_id internal_id) noexcept
+        {
+            return internal_id == Internal_id::not_internal || internal_id == Internal_id::subscribe ||
+                   internal_id == Internal_id::unsubscribe;
+        }
+
+        // Drops the messages the remote has received
+        void acknowledge(uint64_t remote_received_count)
+        {
+            while (!m_unacked.empty() && m_sent_count - m_unacked.size() < remote_received_count)
+                m_unacked.pop_front();
+        }
+
+        // Returns true when an ack should be sent
+        [[nodiscard]] bool should_ack() const noexcept
+        {
+            return m_received_count - m_acked_received_count >= ACK_INTERVAL;
+        }
+    };
+} // namespace Net
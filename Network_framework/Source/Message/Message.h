@@ -163,6 +163,26 @@ namespace Net
             m_header.m_id = new_id;
         }
 
+        /**
+         *   Marks the message as request or response.
+         *   This is set by the framework when the request or response is sent.
+         */
+        void set_rpc(Rpc_type rpc_type, uint32_t correlation_id) noexcept
+        {
+            m_header.m_rpc_type = rpc_type;
+            m_header.m_correlation_id = correlation_id;
+        }
+
+        [[nodiscard]] Rpc_type get_rpc_type() const noexcept
+        {
+            return m_header.m_rpc_type;
+        }
+
+        [[nodiscard]] uint32_t get_correlation_id() const noexcept
+        {
+            return m_header.m_correlation_id;
+        }
+
         void clear() noexcept
         {
             m_body.clear();
@@ -7,6 +7,50 @@ namespace Net
     struct Server_data
     {
         uint32_t m_client_id = 0;
+
+        // Zero if the server does not keep sessions
+        uint64_t m_session_token = 0;
+    };
+
+    // Times are nanoseconds since the epoch of the system clock
+    struct Ping_data
+    {
+        int64_t m_send_time = 0;
+    };
+
+    struct Pong_data
+    {
+        int64_t m_ping_send_time = 0;
+        int64_t m_ping_receive_time = 0;
+        int64_t m_send_time = 0;
+    };
+
+    // Counts are the amount of the messages received in the session that were not internal
+    struct Session_resume_data
+    {
+        uint64_t m_session_token = 0;
+        uint64_t m_received_count = 0;
+        uint32_t m_client_id = 0;
+    };
+
+    struct Session_resumed_data
+    {
+        uint64_t m_received_count = 0;
+        uint32_t m_client_id = 0;
+
+        // False if the session could not be resumed and the client got a new session
+        bool m_is_resumed = false;
+    };
+
+    struct Ack_data
+    {
+        uint64_t m_received_count = 0;
+    };
+
+    // Used for both subscribing and unsubscribing
+    struct Topic_data
+    {
+        uint64_t m_topic = 0;
     };
 
     // Static class that is used internally by the framework
@@ -39,5 +83,153 @@ namespace Net
             in_message >> output;
             return output;
         }
+
+        static Message<Id_type> create_ping(const Ping_data& data)
+        {
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::ping);
+            output << data;
+            return output;
+        }
+
+        // @throws if the message internal id is not the ping
+        static Ping_data extract_ping(Message<Id_type>& in_message)
+        {
+            if (in_message.get_internal_id() != Internal_id::ping)
+                throw std::invalid_argument("Message has wrong id");
+
+            Ping_data output;
+            in_message >> output;
+            return output;
+        }
+
+        static Message<Id_type> create_pong(const Pong_data& data)
+        {
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::pong);
+            output << data;
+            return output;
+        }
+
+        // @throws if the message internal id is not the pong
+        static Pong_data extract_pong(Message<Id_type>& in_message)
+        {
+            if (in_message.get_internal_id() != Internal_id::pong)
+                throw std::invalid_argument("Message has wrong id");
+
+            Pong_data output;
+            in_message >> output;
+            return output;
+        }
+
+        static Message<Id_type> create_session_resume(const Session_resume_data& data)
+        {
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::session_resume);
+            output << data;
+            return output;
+        }
+
+        // @throws if the message internal id is not the session_resume
+        static Session_resume_data extract_session_resume(Message<Id_type>& in_message)
+        {
+            if (in_message.get_internal_id() != Internal_id::session_resume)
+                throw std::invalid_argument("Message has wrong id");
+
+            Session_resume_data output;
+            in_message >> output;
+            return output;
+        }
+
+        static Message<Id_type> create_session_resumed(const Session_resumed_data& data)
+        {
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::session_resumed);
+            output << data;
+            return output;
+        }
+
+        // @throws if the message internal id is not the session_resumed
+        static Session_resumed_data extract_session_resumed(Message<Id_type>& in_message)
+        {
+            if (in_message.get_internal_id() != Internal_id::session_resumed)
+                throw std::invalid_argument("Message has wrong id");
+
+            Session_resumed_data output;
+            in_message >> output;
+            return output;
+        }
+
+        static Message<Id_type> create_ack(const Ack_data& data)
+        {
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::ack);
+            output << data;
+            return output;
+        }
+
+        // @throws if the message internal id is not the ack
+        static Ack_data extract_ack(Message<Id_type>& in_message)
+        {
+            if (in_message.get_internal_id() != Internal_id::ack)
+                throw std::invalid_argument("Message has wrong id");
+
+            Ack_data output;
+            in_message >> output;
+            return output;
+        }
+
+        static Message<Id_type> create_subscribe(const Topic_data& data)
+        {
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::subscribe);
+            output << data;
+            return output;
+        }
+
+        static Message<Id_type> create_unsubscribe(const Topic_data& data)
+        {
+            Message<Id_type> output;
+            output.set_internal_id(Internal_id::unsubscribe);
+            output << data;
+            return output;
+        }
+
+        // @throws if the message internal id is not the subscribe or unsubscribe
+        static Topic_data extract_topic(Message<Id_type>& in_message)
+        {
+            const Internal_id internal_id = in_message.get_internal_id();
+            if (internal_id != Internal_id::subscribe && internal_id != Internal_id::unsubscribe)
+                throw std::invalid_argument("Message has wrong id");
+
+            Topic_data output;
+            in_message >> output;
+            return output;
+        }
+
+        // Size of the body that the internal message should have
+        [[nodiscard]] static constexpr size_t internal_body_size(Internal_id internal_id) noexcept
+        {
+            switch (internal_id)
+            {
+            case Internal_id::server_accept:
+                return sizeof(Server_data);
+            case Internal_id::ping:
+                return sizeof(Ping_data);
+            case Internal_id::pong:
+                return sizeof(Pong_data);
+            case Internal_id::session_resume:
+                return sizeof(Session_resume_data);
+            case Internal_id::session_resumed:
+                return sizeof(Session_resumed_data);
+            case Internal_id::ack:
+                return sizeof(Ack_data);
+            case Internal_id::subscribe:
+            case Internal_id::unsubscribe:
+                return sizeof(Topic_data);
+            default:
+                return 0;
+            }
+        }
     };
 } // namespace Net
@@ -9,7 +9,22 @@ namespace Net
     enum class Internal_id : uint8_t
     {
         not_internal,
-        server_accept
+        server_accept,
+        ping,
+        pong,
+        session_resume,
+        session_resumed,
+        ack,
+        subscribe,
+        unsubscribe
+    };
+
+    // Role of the message in the request and response pairs
+    enum class Rpc_type : uint8_t
+    {
+        none,
+        request,
+        response
     };
 
     // Type that is used to indicate how large the message is in the header
@@ -33,6 +48,10 @@ namespace Net
         // Id used to recognize what type of message this is
         Id_type m_id = {};
 
+        // Response has the correlation id of its request. Fits in the padding so the header does not grow.
+        Rpc_type m_rpc_type = Rpc_type::none;
+        uint32_t m_correlation_id = 0;
+
         // Size of the message
         Header_size_type m_size = 0;
 
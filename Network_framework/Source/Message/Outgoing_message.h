@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Message.h"
+#include <memory>
+
+namespace Net
+{
+    // Message that is shared by the connections instead of copied for each of them
+    template <Id_concept Id_type>
+    using Shared_message = std::shared_ptr<const Message<Id_type>>;
+
+    // Message waiting to be written. Either owns the message or shares it with the other connections.
+    template <Id_concept Id_type>
+    class Outgoing_message
+    {
+    public:
+        Outgoing_message(Message<Id_type> message) noexcept : m_message(std::move(message))
+        {
+        }
+
+        Outgoing_message(Shared_message<Id_type> message) noexcept : m_shared_message(std::move(message))
+        {
+        }
+
+        [[nodiscard]] const Message<Id_type>& get() const noexcept
+        {
+            return m_shared_message != nullptr ? *m_shared_message : m_message;
+        }
+
+    private:
+        Message<Id_type> m_message;
+        Shared_message<Id_type> m_shared_message;
+    };
+} // namespace Net
@@ -2,6 +2,7 @@
 
 #include "../Utility/Client_information.h"
 #include "Message.h"
+#include <memory>
 
 namespace Net
 {
@@ -9,8 +10,11 @@ namespace Net
     template <Id_concept Id_type>
     struct Owned_message
     {
-
-        Owned_message(Message<Id_type> message, Client_information client_information) noexcept
+        /**
+         *   @param the message
+         *   @param the sender. It is shared with the connection so the message does not need to copy the ip.
+         */
+        Owned_message(Message<Id_type> message, std::shared_ptr<const Client_information> client_information) noexcept
             : m_message(std::move(message)), m_client_information(std::move(client_information))
         {
         }
@@ -23,7 +27,7 @@ namespace Net
 
         [[nodiscard]] bool operator==(const Owned_message& other) const noexcept
         {
-            return m_client_information == other.m_client_information && m_message == other.m_message;
+            return get_client_information() == other.get_client_information() && m_message == other.m_message;
         }
 
         [[nodiscard]] bool operator!=(const Owned_message& other) const noexcept
@@ -31,7 +35,17 @@ namespace Net
             return !(*this == other);
         }
 
+        [[nodiscard]] const Client_information& get_client_information() const noexcept
+        {
+            return *m_client_information;
+        }
+
+        [[nodiscard]] uint32_t get_client_id() const noexcept
+        {
+            return m_client_information->m_id;
+        }
+
         Message<Id_type> m_message;
-        const Client_information m_client_information;
+        std::shared_ptr<const Client_information> m_client_information;
     };
 } // namespace Net
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "../Events/Delegate.h"
+#include "../Utility/Common.h"
+#include "Socket_interface.h"
+#include <functional>
+#include <memory>
+
+namespace Net
+{
+    // Accepts new connections from any kind of endpoint
+    class Acceptor_interface
+    {
+    public:
+        Acceptor_interface() = default;
+        virtual ~Acceptor_interface() = default;
+
+        Acceptor_interface(const Acceptor_interface&) = delete;
+        Acceptor_interface(Acceptor_interface&&) = delete;
+
+        Acceptor_interface& operator=(const Acceptor_interface&) = delete;
+        Acceptor_interface& operator=(Acceptor_interface&&) = delete;
+
+        // Keeps accepting connections until closed
+        virtual void async_accept() = 0;
+        virtual void close() = 0;
+
+        // Socket is nullptr if there was error
+        Delegate<asio::error_code, std::unique_ptr<Socket_interface>> m_on_accepted;
+    };
+
+    template <typename Asio_protocol>
+    class Template_acceptor : public Acceptor_interface
+    {
+    public:
+        using Asio_acceptor = typename Asio_protocol::acceptor;
+        using Asio_socket = typename Asio_protocol::socket;
+        using Socket_factory = std::function<std::unique_ptr<Socket_interface>(Asio_socket)>;
+
+        /**
+         *   @param the Asio acceptor that is already listening
+         *   @param creates socket interface for the accepted Asio socket
+         */
+        Template_acceptor(Asio_acceptor acceptor, Socket_factory socket_factory)
+            : m_acceptor(std::move(acceptor)), m_socket_factory(std::move(socket_factory))
+        {
+        }
+
+        void async_accept() override
+        {
+            m_acceptor.async_accept([this](asio::error_code error, Asio_socket socket) {
+                if (!error)
+                    m_on_accepted.broadcast(error, m_socket_factory(std::move(socket)));
+                else
+                    m_on_accepted.broadcast(error, nullptr);
+
+                if (m_acceptor.is_open())
+                    async_accept();
+            });
+        }
+
+        void close() override
+        {
+            asio::error_code error;
+            m_acceptor.close(error);
+        }
+
+    private:
+        Asio_acceptor m_acceptor;
+        Socket_factory m_socket_factory;
+    };
+} // namespace Net
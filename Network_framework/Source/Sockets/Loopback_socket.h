@@ -0,0 +1,379 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include "Acceptor.h"
+#include "Socket_interface.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Socket that is connected to other socket in the same process and moves the bytes between buffers.
+     *   Both sockets can be handled by different Asio threads. Used for measuring the framework without the kernel.
+     */
+    class Loopback_socket : public Socket_interface
+    {
+    public:
+        static constexpr size_t DEFAULT_CAPACITY = 1ull << 22;
+
+        /**
+         *   Creates the connected pair of sockets
+         *
+         *   @param the executor that handles the first socket
+         *   @param the executor that handles the second socket
+         *   @param how many bytes can be buffered in each direction
+         */
+        [[nodiscard]] static std::pair<std::unique_ptr<Loopback_socket>, std::unique_ptr<Loopback_socket>> create_pair(
+            asio::any_io_executor first_executor, asio::any_io_executor second_executor,
+            size_t capacity = DEFAULT_CAPACITY)
+        {
+            auto channel = std::make_shared<Channel>();
+            channel->m_capacity = capacity;
+
+            std::unique_ptr<Loopback_socket> first(new Loopback_socket(channel, 0, std::move(first_executor)));
+            std::unique_ptr<Loopback_socket> second(new Loopback_socket(channel, 1, std::move(second_executor)));
+            return {std::move(first), std::move(second)};
+        }
+
+        Loopback_socket(const Loopback_socket&) = delete;
+        Loopback_socket(Loopback_socket&&) = delete;
+
+        ~Loopback_socket() override
+        {
+            disconnect();
+
+            std::scoped_lock lock(m_channel->m_mutex);
+            m_channel->m_sockets.at(m_side) = nullptr;
+        }
+
+        Loopback_socket& operator=(const Loopback_socket&) = delete;
+        Loopback_socket& operator=(Loopback_socket&&) = delete;
+
+        void async_handshake([[maybe_unused]] Handshake_type type) override
+        {
+            m_handler->async_handshake_finished(asio::error_code());
+        }
+
+        void async_read_header(void* buffer, size_t size) override
+        {
+            start_read(buffer, size, &Socket_handler::async_read_header_finished);
+        }
+
+        void async_read_body(void* buffer, size_t size) override
+        {
+            start_read(buffer, size, &Socket_handler::async_read_body_finished);
+        }
+
+        void async_write_header(const void* buffer, size_t size) override
+        {
+            start_write(buffer, size, &Socket_handler::async_write_header_finished);
+        }
+
+        void async_write_body(const void* buffer, size_t size) override
+        {
+            start_write(buffer, size, &Socket_handler::async_write_body_finished);
+        }
+
+        [[nodiscard]] bool is_open() const override
+        {
+            return m_is_open;
+        }
+
+        [[nodiscard]] std::string get_ip() const override
+        {
+            return "loopback";
+        }
+
+        [[nodiscard]] asio::ip::address get_address() const override
+        {
+            return {};
+        }
+
+        void disconnect() override
+        {
+            if (!m_is_open.exchange(false))
+                return;
+
+            {
+                std::scoped_lock lock(m_channel->m_mutex);
+                m_channel->m_is_closed = true;
+            }
+
+            // Both sides fail their pending operations when they see the channel closed
+            wake(m_side);
+            wake(1 - m_side);
+        }
+
+        asio::error_code set_options([[maybe_unused]] const Socket_options& options) override
+        {
+            return {};
+        }
+
+        void post(std::function<void()> function) override
+        {
+            asio::post(m_executor, std::move(function));
+        }
+
+        [[nodiscard]] asio::any_io_executor get_executor() override
+        {
+            return m_executor;
+        }
+
+    private:
+        // Bytes written by one side that the other side has not read yet
+        struct Pipe
+        {
+            std::vector<char> m_bytes;
+            size_t m_read_offset = 0;
+
+            [[nodiscard]] size_t size() const noexcept
+            {
+                return m_bytes.size() - m_read_offset;
+            }
+
+            void consume(size_t amount) noexcept
+            {
+                m_read_offset += amount;
+
+                if (m_read_offset == m_bytes.size())
+                {
+                    m_bytes.clear();
+                    m_read_offset = 0;
+                }
+                else if (m_read_offset > m_bytes.size() / 2)
+                {
+                    m_bytes.erase(m_bytes.begin(), m_bytes.begin() + static_cast<std::ptrdiff_t>(m_read_offset));
+                    m_read_offset = 0;
+                }
+            }
+        };
+
+        // State shared by the pair. Pipe of the side is the one it writes to.
+        struct Channel
+        {
+            std::mutex m_mutex;
+            std::array<Pipe, 2> m_pipes;
+            std::array<Loopback_socket*, 2> m_sockets = {};
+            std::array<bool, 2> m_is_waiting = {};
+            size_t m_capacity = 0;
+            bool m_is_closed = false;
+        };
+
+        // Read or write that has not been completed yet
+        struct Operation
+        {
+            char* m_buffer = nullptr;
+            size_t m_size = 0;
+            size_t m_done = 0;
+            Socket_handler::Completion m_finished = nullptr;
+
+            [[nodiscard]] bool is_pending() const noexcept
+            {
+                return m_finished != nullptr;
+            }
+        };
+
+        Loopback_socket(std::shared_ptr<Channel> channel, size_t side, asio::any_io_executor executor)
+            : m_channel(std::move(channel)), m_side(side), m_executor(std::move(executor))
+        {
+            m_channel->m_sockets.at(m_side) = this;
+        }
+
+        // Operations are started in the Asio thread because the messages can be sent from other threads.
+        // The socket can be destroyed before the posted start runs.
+        void start_read(void* buffer, size_t size, Socket_handler::Completion finished)
+        {
+            asio::dispatch(m_executor, [this, is_alive = m_is_alive, buffer, size, finished] {
+                if (!*is_alive)
+                    return;
+
+                m_read = {.m_buffer = static_cast<char*>(buffer), .m_size = size, .m_finished = finished};
+                progress();
+            });
+        }
+
+        void start_write(const void* buffer, size_t size, Socket_handler::Completion finished)
+        {
+            asio::dispatch(m_executor, [this, is_alive = m_is_alive, buffer, size, finished] {
+                if (!*is_alive)
+                    return;
+
+                // The buffer is only read from
+                char* write_buffer = static_cast<char*>(const_cast<void*>(buffer));
+                m_write = {.m_buffer = write_buffer, .m_size = size, .m_finished = finished};
+                progress();
+            });
+        }
+
+        // Moves the pending operations forward and wakes up the other side if it was waiting for us
+        void progress()
+        {
+            bool should_wake_peer = false;
+
+            {
+                std::scoped_lock lock(m_channel->m_mutex);
+
+                Pipe& in_pipe = m_channel->m_pipes.at(1 - m_side);
+                Pipe& out_pipe = m_channel->m_pipes.at(m_side);
+                bool has_moved_bytes = false;
+
+                if (m_read.is_pending())
+                {
+                    const size_t amount = std::min(m_read.m_size - m_read.m_done, in_pipe.size());
+                    const char* source = in_pipe.m_bytes.data() + in_pipe.m_read_offset;
+                    std::memcpy(m_read.m_buffer + m_read.m_done, source, amount);
+                    in_pipe.consume(amount);
+                    m_read.m_done += amount;
+                    has_moved_bytes |= amount > 0;
+
+                    if (m_read.m_done == m_read.m_size)
+                        complete(m_read, asio::error_code());
+                }
+
+                if (m_write.is_pending() && !m_channel->m_is_closed)
+                {
+                    const size_t space = m_channel->m_capacity - std::min(m_channel->m_capacity, out_pipe.size());
+                    const size_t amount = std::min(m_write.m_size - m_write.m_done, space);
+                    out_pipe.m_bytes.insert(out_pipe.m_bytes.end(), m_write.m_buffer + m_write.m_done,
+                                            m_write.m_buffer + m_write.m_done + amount);
+                    m_write.m_done += amount;
+                    has_moved_bytes |= amount > 0;
+
+                    if (m_write.m_done == m_write.m_size)
+                        complete(m_write, asio::error_code());
+                }
+
+                // Remaining bytes can still be read after the channel was closed
+                if (m_channel->m_is_closed)
+                {
+                    if (m_write.is_pending())
+                        complete(m_write, asio::error::eof);
+
+                    if (m_read.is_pending() && in_pipe.size() == 0)
+                        complete(m_read, asio::error::eof);
+                }
+
+                m_channel->m_is_waiting.at(m_side) = m_read.is_pending() || m_write.is_pending();
+
+                const size_t peer_side = 1 - m_side;
+                should_wake_peer = has_moved_bytes && m_channel->m_is_waiting.at(peer_side);
+                if (should_wake_peer)
+                    m_channel->m_is_waiting.at(peer_side) = false;
+            }
+
+            if (should_wake_peer)
+                wake(1 - m_side);
+        }
+
+        // Runs progress on the side in its thread. The socket is looked up when it runs since it can be destroyed.
+        void wake(size_t side)
+        {
+            std::scoped_lock lock(m_channel->m_mutex);
+
+            const Loopback_socket* socket = m_channel->m_sockets.at(side);
+            if (socket == nullptr)
+                return;
+
+            asio::post(socket->m_executor, [channel = m_channel, side] {
+                Loopback_socket* socket = nullptr;
+
+                {
+                    std::scoped_lock lock(channel->m_mutex);
+                    socket = channel->m_sockets.at(side);
+                }
+
+                if (socket != nullptr)
+                    socket->progress();
+            });
+        }
+
+        // Completions are posted so long chains of buffered messages don't grow the stack
+        void complete(Operation& operation, asio::error_code error)
+        {
+            const Socket_handler::Completion finished = operation.m_finished;
+            const size_t bytes = operation.m_done;
+            operation = {};
+
+            post([handler = m_handler, is_alive = m_is_alive, finished, error, bytes] {
+                if (*is_alive)
+                    (handler->*finished)(error, bytes);
+            });
+        }
+
+        std::shared_ptr<Channel> m_channel;
+        size_t m_side = 0;
+        asio::any_io_executor m_executor;
+
+        Operation m_read;
+        Operation m_write;
+
+        std::atomic<bool> m_is_open = true;
+    };
+
+    /**
+     *   Acceptor for the loopback sockets. Clients in the same process connect to it directly.
+     *   Must outlive the connect calls.
+     */
+    class Loopback_acceptor : public Acceptor_interface
+    {
+    public:
+        /**
+         *   @param the executor that handles the accepted sockets
+         *   @param how many bytes can be buffered in each direction
+         */
+        explicit Loopback_acceptor(asio::any_io_executor executor,
+                                   size_t capacity = Loopback_socket::DEFAULT_CAPACITY) noexcept
+            : m_executor(std::move(executor)), m_capacity(capacity)
+        {
+        }
+
+        void async_accept() override
+        {
+            m_is_accepting = true;
+        }
+
+        void close() override
+        {
+            m_is_accepting = false;
+        }
+
+        [[nodiscard]] bool is_accepting() const noexcept
+        {
+            return m_is_accepting;
+        }
+
+        /**
+         *   Creates the connected pair and gives the other one to the acceptor. Can be called from any thread.
+         *
+         *   @param the executor that handles the returned socket
+         *   @return the socket for the connecting side or nullptr if the acceptor is not accepting
+         */
+        [[nodiscard]] std::unique_ptr<Socket_interface> connect(asio::any_io_executor executor)
+        {
+            if (!m_is_accepting)
+                return nullptr;
+
+            auto [accepted_socket, connecting_socket] =
+                Loopback_socket::create_pair(m_executor, std::move(executor), m_capacity);
+
+            asio::post(m_executor, [this, socket = std::move(accepted_socket)]() mutable {
+                if (m_is_accepting)
+                    m_on_accepted.broadcast(asio::error_code(), std::move(socket));
+            });
+
+            return std::move(connecting_socket);
+        }
+
+    private:
+        asio::any_io_executor m_executor;
+        size_t m_capacity = 0;
+        std::atomic<bool> m_is_accepting = false;
+    };
+} // namespace Net
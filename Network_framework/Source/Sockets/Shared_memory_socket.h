@@ -0,0 +1,727 @@
+#pragma once
+
+// Shared memory transport uses mmap and fifos so it is only available on Linux
+#if defined(__linux__)
+
+#include "../Utility/Common.h"
+#include "Acceptor.h"
+#include "Socket_interface.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace Net
+{
+    // Which end of the shared memory region we are
+    enum class Shared_memory_side : uint8_t
+    {
+        server,
+        client
+    };
+
+    // Single producer single consumer byte ring that lives in the shared memory
+    class Shared_memory_ring
+    {
+    public:
+        struct Header
+        {
+            alignas(64) std::atomic<uint64_t> m_write_position = 0;
+            alignas(64) std::atomic<uint64_t> m_read_position = 0;
+            alignas(64) std::atomic<uint32_t> m_is_reader_waiting = 0;
+            std::atomic<uint32_t> m_is_writer_waiting = 0;
+        };
+
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory needs lock free atomics");
+
+        Shared_memory_ring() noexcept = default;
+        Shared_memory_ring(Header* header, char* data, uint64_t capacity) noexcept
+            : m_header(header), m_data(data), m_capacity(capacity)
+        {
+        }
+
+        // Copies as much as fits to the ring and returns the amount copied
+        size_t write_some(const char* buffer, size_t size) noexcept
+        {
+            const uint64_t write_position = m_header->m_write_position.load(std::memory_order_relaxed);
+            const uint64_t read_position = m_header->m_read_position.load(std::memory_order_acquire);
+
+            const size_t amount = std::min<size_t>(size, m_capacity - (write_position - read_position));
+            copy_in(write_position, buffer, amount);
+
+            m_header->m_write_position.store(write_position + amount);
+            return amount;
+        }
+
+        // Copies as much as is available from the ring and returns the amount copied
+        size_t read_some(char* buffer, size_t size) noexcept
+        {
+            const uint64_t read_position = m_header->m_read_position.load(std::memory_order_relaxed);
+            const uint64_t write_position = m_header->m_write_position.load(std::memory_order_acquire);
+
+            const size_t amount = std::min<size_t>(size, write_position - read_position);
+            copy_out(read_position, buffer, amount);
+
+            m_header->m_read_position.store(read_position + amount);
+            return amount;
+        }
+
+        [[nodiscard]] Header& header() noexcept
+        {
+            return *m_header;
+        }
+
+    private:
+        void copy_in(uint64_t position, const char* buffer, size_t size) noexcept
+        {
+            const size_t offset = position & (m_capacity - 1);
+            const size_t first_part = std::min<size_t>(size, m_capacity - offset);
+
+            std::memcpy(m_data + offset, buffer, first_part);
+            std::memcpy(m_data, buffer + first_part, size - first_part);
+        }
+
+        void copy_out(uint64_t position, char* buffer, size_t size) const noexcept
+        {
+            const size_t offset = position & (m_capacity - 1);
+            const size_t first_part = std::min<size_t>(size, m_capacity - offset);
+
+            std::memcpy(buffer, m_data + offset, first_part);
+            std::memcpy(buffer + first_part, m_data, size - first_part);
+        }
+
+        Header* m_header = nullptr;
+        char* m_data = nullptr;
+        uint64_t m_capacity = 0;
+    };
+
+    /**
+     *   Memory mapped file with one ring for each direction and fifo for waking up each side.
+     *   The files are in the path, path.server and path.client.
+     */
+    class Shared_memory_region
+    {
+    public:
+        static constexpr uint64_t DEFAULT_RING_CAPACITY = 1ull << 22;
+
+        Shared_memory_region(const Shared_memory_region&) = delete;
+        Shared_memory_region(Shared_memory_region&&) = delete;
+
+        ~Shared_memory_region()
+        {
+            if (m_memory != MAP_FAILED)
+                munmap(m_memory, m_memory_size);
+
+            for (const int file : {m_file, m_own_fifo, m_peer_fifo})
+                if (file >= 0)
+                    ::close(file);
+        }
+
+        Shared_memory_region& operator=(const Shared_memory_region&) = delete;
+        Shared_memory_region& operator=(Shared_memory_region&&) = delete;
+
+        /**
+         *   Creates the files for new region as the server side
+         *
+         *   @param the path of the region
+         *   @param capacity of each ring, rounded up to power of two
+         *   @throws if the files could not be created
+         */
+        static std::unique_ptr<Shared_memory_region> create(const std::string& path, uint64_t ring_capacity)
+        {
+            ring_capacity = std::bit_ceil(ring_capacity);
+
+            for (const std::string& fifo_path : {path + ".server", path + ".client"})
+            {
+                ::unlink(fifo_path.c_str());
+                if (mkfifo(fifo_path.c_str(), 0600) != 0)
+                    throw_system_error("Failed to create fifo");
+            }
+
+            std::unique_ptr<Shared_memory_region> region(new Shared_memory_region(path, Shared_memory_side::server));
+
+            region->m_file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+            if (region->m_file < 0)
+                throw_system_error("Failed to create shared memory file");
+
+            const size_t memory_size = sizeof(Layout) + 2 * ring_capacity;
+            if (ftruncate(region->m_file, static_cast<off_t>(memory_size)) != 0)
+                throw_system_error("Failed to resize shared memory file");
+
+            region->map(memory_size);
+            new (region->m_memory) Layout();
+            region->layout().m_ring_capacity = ring_capacity;
+            region->open_fifos();
+            return region;
+        }
+
+        /**
+         *   Opens region that was created by the server and removes its files
+         *
+         *   @throws if the region could not be opened
+         */
+        static std::unique_ptr<Shared_memory_region> open(const std::string& path)
+        {
+            std::unique_ptr<Shared_memory_region> region(new Shared_memory_region(path, Shared_memory_side::client));
+
+            region->m_file = ::open(path.c_str(), O_RDWR);
+            if (region->m_file < 0)
+                throw_system_error("Failed to open shared memory file");
+
+            struct stat file_status = {};
+            if (fstat(region->m_file, &file_status) != 0)
+                throw_system_error("Failed to read shared memory file size");
+
+            if (static_cast<size_t>(file_status.st_size) < sizeof(Layout))
+                throw std::runtime_error("Shared memory file is too small");
+
+            region->map(static_cast<size_t>(file_status.st_size));
+
+            const uint64_t ring_capacity = region->layout().m_ring_capacity;
+            if (!std::has_single_bit(ring_capacity) || sizeof(Layout) + 2 * ring_capacity > region->m_memory_size)
+                throw std::runtime_error("Invalid shared memory ring capacity");
+
+            region->open_fifos();
+            region->remove_files();
+            return region;
+        }
+
+        // Ring this side writes to
+        [[nodiscard]] Shared_memory_ring out_ring() noexcept
+        {
+            return m_side == Shared_memory_side::server ? ring(0) : ring(1);
+        }
+
+        // Ring this side reads from
+        [[nodiscard]] Shared_memory_ring in_ring() noexcept
+        {
+            return m_side == Shared_memory_side::server ? ring(1) : ring(0);
+        }
+
+        // Fifo that wakes up this side
+        [[nodiscard]] int own_fifo() const noexcept
+        {
+            return m_own_fifo;
+        }
+
+        // Wakes up the other side
+        void wake_peer() const noexcept
+        {
+            const char byte = 0;
+            [[maybe_unused]] const auto result = ::write(m_peer_fifo, &byte, 1);
+        }
+
+        void mark_closed() noexcept
+        {
+            layout().m_is_closed = 1;
+            wake_peer();
+        }
+
+        [[nodiscard]] bool is_closed() noexcept
+        {
+            return layout().m_is_closed != 0;
+        }
+
+        void remove_files() const noexcept
+        {
+            for (const std::string& file_path : {m_path, m_path + ".server", m_path + ".client"})
+                ::unlink(file_path.c_str());
+        }
+
+    private:
+        struct Layout
+        {
+            uint64_t m_ring_capacity = 0;
+            std::atomic<uint32_t> m_is_closed = 0;
+            std::array<Shared_memory_ring::Header, 2> m_rings;
+        };
+
+        Shared_memory_region(std::string path, Shared_memory_side side) noexcept : m_path(std::move(path)), m_side(side)
+        {
+        }
+
+        [[noreturn]] static void throw_system_error(const char* what)
+        {
+            throw std::system_error(errno, std::system_category(), what);
+        }
+
+        void map(size_t memory_size)
+        {
+            m_memory_size = memory_size;
+            m_memory = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+
+            if (m_memory == MAP_FAILED)
+                throw_system_error("Failed to map shared memory");
+        }
+
+        // Read write mode so opening does not block and the fifo never reports end of file
+        void open_fifos()
+        {
+            const bool is_server = m_side == Shared_memory_side::server;
+            const std::string own_path = m_path + (is_server ? ".server" : ".client");
+            const std::string peer_path = m_path + (is_server ? ".client" : ".server");
+
+            m_own_fifo = ::open(own_path.c_str(), O_RDWR | O_NONBLOCK);
+            m_peer_fifo = ::open(peer_path.c_str(), O_RDWR | O_NONBLOCK);
+
+            if (m_own_fifo < 0 || m_peer_fifo < 0)
+                throw_system_error("Failed to open shared memory fifo");
+        }
+
+        [[nodiscard]] Layout& layout() noexcept
+        {
+            return *static_cast<Layout*>(m_memory);
+        }
+
+        [[nodiscard]] Shared_memory_ring ring(size_t index) noexcept
+        {
+            const uint64_t capacity = layout().m_ring_capacity;
+            char* data = static_cast<char*>(m_memory) + sizeof(Layout) + index * capacity;
+            return Shared_memory_ring(&layout().m_rings.at(index), data, capacity);
+        }
+
+        std::string m_path;
+        Shared_memory_side m_side;
+
+        int m_file = -1;
+        int m_own_fifo = -1;
+        int m_peer_fifo = -1;
+
+        void* m_memory = MAP_FAILED;
+        size_t m_memory_size = 0;
+    };
+
+    /**
+     *   Socket that moves the bytes through shared memory rings.
+     *   The unix domain socket used for setting up the region is kept open so we notice if the other process dies.
+     */
+    class Shared_memory_socket : public Socket_interface
+    {
+    public:
+        Shared_memory_socket(std::unique_ptr<Shared_memory_region> region, Local_protocol::socket rendezvous_socket)
+            : m_region(std::move(region)), m_rendezvous_socket(std::move(rendezvous_socket)),
+              m_wake_descriptor(m_rendezvous_socket.get_executor(), ::dup(m_region->own_fifo())),
+              m_out_ring(m_region->out_ring()), m_in_ring(m_region->in_ring())
+        {
+            watch_rendezvous_socket();
+        }
+
+        Shared_memory_socket(const Shared_memory_socket&) = delete;
+        Shared_memory_socket(Shared_memory_socket&&) = delete;
+
+        ~Shared_memory_socket() override
+        {
+            disconnect();
+        }
+
+        Shared_memory_socket& operator=(const Shared_memory_socket&) = delete;
+        Shared_memory_socket& operator=(Shared_memory_socket&&) = delete;
+
+        void async_handshake([[maybe_unused]] Handshake_type type) override
+        {
+            m_handler->async_handshake_finished(asio::error_code());
+        }
+
+        void async_read_header(void* buffer, size_t size) override
+        {
+            start_read(buffer, size, &Socket_handler::async_read_header_finished);
+        }
+
+        void async_read_body(void* buffer, size_t size) override
+        {
+            start_read(buffer, size, &Socket_handler::async_read_body_finished);
+        }
+
+        void async_write_header(const void* buffer, size_t size) override
+        {
+            start_write(buffer, size, &Socket_handler::async_write_header_finished);
+        }
+
+        void async_write_body(const void* buffer, size_t size) override
+        {
+            start_write(buffer, size, &Socket_handler::async_write_body_finished);
+        }
+
+        [[nodiscard]] bool is_open() const override
+        {
+            return m_is_open;
+        }
+
+        [[nodiscard]] std::string get_ip() const override
+        {
+            return "shared_memory";
+        }
+
+        [[nodiscard]] asio::ip::address get_address() const override
+        {
+            return {};
+        }
+
+        void disconnect() override
+        {
+            if (!m_is_open.exchange(false))
+                return;
+
+            m_region->mark_closed();
+
+            asio::error_code error;
+            m_wake_descriptor.close(error);
+            m_rendezvous_socket.close(error);
+            fail_operations(asio::error::operation_aborted);
+        }
+
+        asio::error_code set_options([[maybe_unused]] const Socket_options& options) override
+        {
+            return {};
+        }
+
+        void post(std::function<void()> function) override
+        {
+            asio::post(m_rendezvous_socket.get_executor(), std::move(function));
+        }
+
+        [[nodiscard]] asio::any_io_executor get_executor() override
+        {
+            return m_rendezvous_socket.get_executor();
+        }
+
+    private:
+        // Read or write that has not been completed yet
+        struct Operation
+        {
+            char* m_buffer = nullptr;
+            size_t m_size = 0;
+            size_t m_done = 0;
+            Socket_handler::Completion m_finished = nullptr;
+
+            [[nodiscard]] bool is_pending() const noexcept
+            {
+                return m_finished != nullptr;
+            }
+        };
+
+        // Operations are started in the Asio thread because the messages can be sent from other threads.
+        // The socket can be destroyed before the posted start runs so every handler checks that it is still alive.
+        void start_read(void* buffer, size_t size, Socket_handler::Completion finished)
+        {
+            asio::dispatch(m_rendezvous_socket.get_executor(), [this, is_alive = m_is_alive, buffer, size, finished] {
+                if (!*is_alive)
+                    return;
+
+                m_read = {.m_buffer = static_cast<char*>(buffer), .m_size = size, .m_finished = finished};
+                progress();
+            });
+        }
+
+        void start_write(const void* buffer, size_t size, Socket_handler::Completion finished)
+        {
+            asio::dispatch(m_rendezvous_socket.get_executor(), [this, is_alive = m_is_alive, buffer, size, finished] {
+                if (!*is_alive)
+                    return;
+
+                // The buffer is only read from
+                char* write_buffer = static_cast<char*>(const_cast<void*>(buffer));
+                m_write = {.m_buffer = write_buffer, .m_size = size, .m_finished = finished};
+                progress();
+            });
+        }
+
+        // Moves the pending operations forward and waits for the other side if they could not be completed
+        void progress()
+        {
+            while (true)
+            {
+                if (!m_is_open || m_region->is_closed())
+                {
+                    fail_operations(asio::error::eof);
+                    return;
+                }
+
+                transfer();
+
+                const bool is_reading_stuck = m_read.is_pending();
+                const bool is_writing_stuck = m_write.is_pending();
+
+                if (!is_reading_stuck && !is_writing_stuck)
+                    return;
+
+                // Tells the other side to wake us up and then checks again so the wake up can't be missed
+                m_in_ring.header().m_is_reader_waiting = is_reading_stuck ? 1 : 0;
+                m_out_ring.header().m_is_writer_waiting = is_writing_stuck ? 1 : 0;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (!transfer())
+                {
+                    wait_for_peer();
+                    return;
+                }
+
+                m_in_ring.header().m_is_reader_waiting = 0;
+                m_out_ring.header().m_is_writer_waiting = 0;
+            }
+        }
+
+        // Copies bytes for the pending operations and completes them. Returns true if any bytes were moved.
+        bool transfer()
+        {
+            bool has_moved_bytes = false;
+
+            if (m_read.is_pending())
+            {
+                const size_t amount =
+                    m_in_ring.read_some(m_read.m_buffer + m_read.m_done, m_read.m_size - m_read.m_done);
+                m_read.m_done += amount;
+                has_moved_bytes |= amount > 0;
+
+                if (amount > 0 && m_in_ring.header().m_is_writer_waiting)
+                    m_region->wake_peer();
+
+                if (m_read.m_done == m_read.m_size)
+                    complete(m_read, asio::error_code());
+            }
+
+            if (m_write.is_pending())
+            {
+                const size_t amount =
+                    m_out_ring.write_some(m_write.m_buffer + m_write.m_done, m_write.m_size - m_write.m_done);
+                m_write.m_done += amount;
+                has_moved_bytes |= amount > 0;
+
+                if (amount > 0 && m_out_ring.header().m_is_reader_waiting)
+                    m_region->wake_peer();
+
+                if (m_write.m_done == m_write.m_size)
+                    complete(m_write, asio::error_code());
+            }
+
+            return has_moved_bytes;
+        }
+
+        // Completions are posted so long chains of buffered messages don't grow the stack
+        void complete(Operation& operation, asio::error_code error)
+        {
+            const Socket_handler::Completion finished = operation.m_finished;
+            const size_t bytes = operation.m_done;
+            operation = {};
+
+            post([handler = m_handler, is_alive = m_is_alive, finished, error, bytes] {
+                if (*is_alive)
+                    (handler->*finished)(error, bytes);
+            });
+        }
+
+        void fail_operations(asio::error_code error)
+        {
+            if (m_read.is_pending())
+                complete(m_read, error);
+
+            if (m_write.is_pending())
+                complete(m_write, error);
+        }
+
+        void wait_for_peer()
+        {
+            if (m_is_waiting_for_peer)
+                return;
+
+            m_is_waiting_for_peer = true;
+            // Closing doesn't abort the wake up that has already completed but not run yet
+            auto on_woken = [this, is_alive = m_is_alive](asio::error_code error) {
+                if (!*is_alive || error == asio::error::operation_aborted)
+                    return;
+
+                m_is_waiting_for_peer = false;
+
+                if (error)
+                {
+                    fail_operations(error);
+                    return;
+                }
+
+                // Empties the fifo so the next wait does not complete right away
+                std::array<char, 64> drain_buffer;
+                while (::read(m_wake_descriptor.native_handle(), drain_buffer.data(), drain_buffer.size()) > 0)
+                {
+                }
+
+                m_in_ring.header().m_is_reader_waiting = 0;
+                m_out_ring.header().m_is_writer_waiting = 0;
+                progress();
+            };
+
+            m_wake_descriptor.async_wait(asio::posix::stream_descriptor::wait_read, std::move(on_woken));
+        }
+
+        // Nothing is sent through the socket after the setup so any completion means the other side is gone
+        void watch_rendezvous_socket()
+        {
+            auto on_peer_gone = [this, is_alive = m_is_alive](asio::error_code error, [[maybe_unused]] size_t bytes) {
+                if (!*is_alive || error == asio::error::operation_aborted)
+                    return;
+
+                fail_operations(asio::error::eof);
+                disconnect();
+            };
+
+            m_rendezvous_socket.async_read_some(asio::buffer(&m_rendezvous_byte, 1), std::move(on_peer_gone));
+        }
+
+        std::unique_ptr<Shared_memory_region> m_region;
+        Local_protocol::socket m_rendezvous_socket;
+        asio::posix::stream_descriptor m_wake_descriptor;
+
+        Shared_memory_ring m_out_ring;
+        Shared_memory_ring m_in_ring;
+
+        Operation m_read;
+        Operation m_write;
+
+        // Read from the thread calling update through the connection
+        std::atomic<bool> m_is_open = true;
+        bool m_is_waiting_for_peer = false;
+        char m_rendezvous_byte = 0;
+    };
+
+    /**
+     *   Accepts unix domain socket connections and gives each of them own shared memory region.
+     *   The path of the region is sent to the client as 32 bit length and the path.
+     */
+    class Shared_memory_acceptor : public Acceptor_interface
+    {
+    public:
+        /**
+         *   @param the Asio acceptor that is already listening
+         *   @param the regions are created to this path with number appended
+         *   @param capacity of each ring
+         */
+        Shared_memory_acceptor(Local_protocol::acceptor acceptor, std::string region_path, uint64_t ring_capacity)
+            : m_acceptor(std::move(acceptor)), m_region_path(std::move(region_path)), m_ring_capacity(ring_capacity)
+        {
+        }
+
+        void async_accept() override
+        {
+            m_acceptor.async_accept([this](asio::error_code error, Local_protocol::socket socket) {
+                if (!error)
+                    setup_region(std::move(socket));
+                else
+                    m_on_accepted.broadcast(error, nullptr);
+
+                if (m_acceptor.is_open())
+                    async_accept();
+            });
+        }
+
+        void close() override
+        {
+            asio::error_code error;
+            m_acceptor.close(error);
+        }
+
+    private:
+        void setup_region(Local_protocol::socket socket)
+        {
+            const std::string path = m_region_path + "." + std::to_string(m_region_count++);
+            std::unique_ptr<Shared_memory_region> region;
+
+            try
+            {
+                region = Shared_memory_region::create(path, m_ring_capacity);
+            }
+            catch (const std::system_error& exception)
+            {
+                m_on_accepted.broadcast(exception.code(), nullptr);
+                return;
+            }
+
+            // The message is tiny and the socket is new so the write does not block
+            const auto path_size = static_cast<uint32_t>(path.size());
+            const std::array buffers = {asio::buffer(&path_size, sizeof(path_size)), asio::buffer(path)};
+
+            asio::error_code error;
+            asio::write(socket, buffers, error);
+
+            if (error)
+            {
+                region->remove_files();
+                m_on_accepted.broadcast(error, nullptr);
+                return;
+            }
+
+            auto shared_memory_socket = std::make_unique<Shared_memory_socket>(std::move(region), std::move(socket));
+            m_on_accepted.broadcast(error, std::move(shared_memory_socket));
+        }
+
+        Local_protocol::acceptor m_acceptor;
+        std::string m_region_path;
+        uint64_t m_ring_capacity = 0;
+        uint64_t m_region_count = 0;
+    };
+
+    /**
+     *   Reads the region path sent by the Shared_memory_acceptor and opens the region
+     *
+     *   @param the socket connected to the acceptor
+     *   @param called with the error and the socket that is nullptr if there was error
+     */
+    template <typename Handler>
+    void async_open_shared_memory_socket(Local_protocol::socket socket, Handler handler)
+    {
+        constexpr uint32_t MAX_PATH_SIZE = 4096;
+
+        struct Setup
+        {
+            Local_protocol::socket m_socket;
+            uint32_t m_path_size = 0;
+            std::string m_path;
+        };
+
+        auto setup = std::make_shared<Setup>(std::move(socket));
+
+        asio::async_read(
+            setup->m_socket, asio::buffer(&setup->m_path_size, sizeof(setup->m_path_size)),
+            [setup, handler = std::move(handler)](asio::error_code error, [[maybe_unused]] size_t bytes) mutable {
+                if (error || setup->m_path_size > MAX_PATH_SIZE)
+                {
+                    handler(error ? error : asio::error::invalid_argument, nullptr);
+                    return;
+                }
+
+                auto open_region = [setup, handler = std::move(handler)](asio::error_code error, size_t) mutable {
+                    if (error)
+                    {
+                        handler(error, nullptr);
+                        return;
+                    }
+
+                    try
+                    {
+                        auto region = Shared_memory_region::open(setup->m_path);
+                        handler(error, std::make_unique<Shared_memory_socket>(std::move(region),
+                                                                              std::move(setup->m_socket)));
+                    }
+                    catch (const std::system_error& exception)
+                    {
+                        handler(exception.code(), nullptr);
+                    }
+                    catch (const std::runtime_error&)
+                    {
+                        handler(asio::error::invalid_argument, nullptr);
+                    }
+                };
+
+                setup->m_path.resize(setup->m_path_size);
+                asio::async_read(setup->m_socket, asio::buffer(setup->m_path), std::move(open_region));
+            });
+    }
+} // namespace Net
+
+#endif
@@ -1,16 +1,24 @@
 #pragma once
 
 #include "../Utility/Common.h"
+#include "../Utility/Handler_memory.h"
 #include "Socket_interface.h"
 #include <type_traits>
 
 namespace Net
 {
-    template <typename Asio_socket>
+    /**
+     *   Socket for the Asio sockets. Completions are given to the Handler type directly so when it is the final
+     *   connection type the calls are not virtual and can be inlined into the Asio handlers.
+     */
+    template <typename Asio_socket, typename Handler = Socket_handler>
     class Template_socket : public Socket_interface
     {
     public:
-        Template_socket(Asio_socket socket) noexcept : m_socket(std::move(socket))
+        static_assert(std::is_base_of_v<Socket_handler, Handler>, "Handler must be socket handler");
+
+        Template_socket(Asio_socket socket) noexcept
+            : m_socket(std::move(socket)), m_remote_address(read_remote_address())
         {
         }
 
@@ -22,59 +30,91 @@ namespace Net
                 switch (type)
                 {
                 case Handshake_type::client:
-                    m_socket.async_handshake(asio::ssl::stream_base::client, [this](asio::error_code error) {
-                        m_handshake_finished.broadcast(error);
-                    });
+                    m_socket.async_handshake(asio::ssl::stream_base::client,
+                                             read_allocated([this, is_alive = m_is_alive](asio::error_code error) {
+                                                 if (*is_alive)
+                                                     handler()->async_handshake_finished(error);
+                                             }));
                     break;
 
                 case Handshake_type::server:
-                    m_socket.async_handshake(asio::ssl::stream_base::server, [this](asio::error_code error) {
-                        m_handshake_finished.broadcast(error);
-                    });
+                    m_socket.async_handshake(asio::ssl::stream_base::server,
+                                             read_allocated([this, is_alive = m_is_alive](asio::error_code error) {
+                                                 if (*is_alive)
+                                                     handler()->async_handshake_finished(error);
+                                             }));
                     break;
                 }
             }
             else
-                m_handshake_finished.broadcast(asio::error_code());
+                handler()->async_handshake_finished(asio::error_code());
         }
 
         void async_read_header(void* buffer, size_t size) override
         {
-            asio::async_read(m_socket, asio::buffer(buffer, size), [this](asio::error_code error, size_t bytes) {
-                m_read_header_finished.broadcast(error, bytes);
-            });
+            asio::async_read(m_socket, asio::buffer(buffer, size),
+                             read_allocated([this, is_alive = m_is_alive](asio::error_code error, size_t bytes) {
+                                 if (*is_alive)
+                                     handler()->async_read_header_finished(error, bytes);
+                             }));
         };
 
         void async_read_body(void* buffer, size_t size) override
         {
-            asio::async_read(m_socket, asio::buffer(buffer, size), [this](asio::error_code error, size_t bytes) {
-                m_read_body_finished.broadcast(error, bytes);
-            });
+            asio::async_read(m_socket, asio::buffer(buffer, size),
+                             read_allocated([this, is_alive = m_is_alive](asio::error_code error, size_t bytes) {
+                                 if (*is_alive)
+                                     handler()->async_read_body_finished(error, bytes);
+                             }));
         }
 
         void async_write_header(const void* buffer, size_t size) override
         {
-            asio::async_write(m_socket, asio::buffer(buffer, size), [this](asio::error_code error, size_t bytes) {
-                m_write_header_finished.broadcast(error, bytes);
-            });
+            asio::async_write(m_socket, asio::buffer(buffer, size),
+                              write_allocated([this, is_alive = m_is_alive](asio::error_code error, size_t bytes) {
+                                  if (*is_alive)
+                                      handler()->async_write_header_finished(error, bytes);
+                              }));
         }
 
         void async_write_body(const void* buffer, size_t size) override
         {
-            asio::async_write(m_socket, asio::buffer(buffer, size), [this](asio::error_code error, size_t bytes) {
-                m_write_body_finished.broadcast(error, bytes);
-            });
+            asio::async_write(m_socket, asio::buffer(buffer, size),
+                              write_allocated([this, is_alive = m_is_alive](asio::error_code error, size_t bytes) {
+                                  if (*is_alive)
+                                      handler()->async_write_body_finished(error, bytes);
+                              }));
         }
 
         void disconnect() override
         {
             if (is_open())
             {
-                m_socket.lowest_layer().shutdown(asio::socket_base::shutdown_both);
-                m_socket.lowest_layer().close();
+                // Fails if the remote has already closed the connection
+                asio::error_code error;
+                m_socket.lowest_layer().shutdown(asio::socket_base::shutdown_both, error);
+                m_socket.lowest_layer().close(error);
             }
         }
 
+        asio::error_code set_options(const Socket_options& options) override
+        {
+            if (!is_open())
+                return asio::error::not_connected;
+
+            return apply_socket_options(m_socket.lowest_layer(), options);
+        }
+
+        void post(std::function<void()> function) override
+        {
+            asio::post(m_socket.get_executor(), std::move(function));
+        }
+
+        [[nodiscard]] asio::any_io_executor get_executor() override
+        {
+            return m_socket.get_executor();
+        }
+
         bool is_open() const override
         {
             return m_socket.lowest_layer().is_open();
@@ -82,13 +122,59 @@ namespace Net
 
         std::string get_ip() const override
         {
-            if (is_open())
-                return m_socket.lowest_layer().remote_endpoint().address().to_string();
-            else
+            if (!is_open())
                 return "0.0.0.0";
+
+            // Unix domain sockets don't have ip
+            if constexpr (std::is_same_v<typename Asio_socket::lowest_layer_type::protocol_type, Local_protocol>)
+                return "local";
+            else
+                return m_remote_address.to_string();
+        }
+
+        asio::ip::address get_address() const override
+        {
+            return m_remote_address;
         }
 
     private:
+        // The sockets are connected when they are created so the address is read only once
+        [[nodiscard]] asio::ip::address read_remote_address() const noexcept
+        {
+            if constexpr (std::is_same_v<typename Asio_socket::lowest_layer_type::protocol_type, Local_protocol>)
+                return {};
+            else
+            {
+                asio::error_code error;
+                const auto endpoint = m_socket.lowest_layer().remote_endpoint(error);
+                return error ? asio::ip::address() : endpoint.address();
+            }
+        }
+
+        // The socket is only created for the matching handler type
+        [[nodiscard]] Handler* handler() const noexcept
+        {
+            return static_cast<Handler*>(m_handler);
+        }
+
+        // Reads and writes are never started again before they finish so they can reuse the same memory
+        template <typename Asio_handler>
+        [[nodiscard]] auto read_allocated(Asio_handler asio_handler) noexcept
+        {
+            return asio::bind_allocator(Handler_allocator<char>(m_read_memory), std::move(asio_handler));
+        }
+
+        template <typename Asio_handler>
+        [[nodiscard]] auto write_allocated(Asio_handler asio_handler) noexcept
+        {
+            return asio::bind_allocator(Handler_allocator<char>(m_write_memory), std::move(asio_handler));
+        }
+
         Asio_socket m_socket;
+        asio::ip::address m_remote_address;
+
+        // Handshake is done before the first read so they share the memory
+        std::shared_ptr<Handler_memory> m_read_memory = std::make_shared<Handler_memory>();
+        std::shared_ptr<Handler_memory> m_write_memory = std::make_shared<Handler_memory>();
     };
 } // namespace Net
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "../Utility/Common.h"
+
+namespace Net
+{
+    /**
+     *   Receives the completions of the socket operations.
+     *   Template_socket calls the handler type it was given directly so the final handler can be inlined.
+     */
+    class Socket_handler
+    {
+    public:
+        using Completion = void (Socket_handler::*)(asio::error_code, size_t);
+
+        virtual void async_handshake_finished(asio::error_code error) = 0;
+        virtual void async_read_header_finished(asio::error_code error, size_t bytes) = 0;
+        virtual void async_read_body_finished(asio::error_code error, size_t bytes) = 0;
+        virtual void async_write_header_finished(asio::error_code error, size_t bytes) = 0;
+        virtual void async_write_body_finished(asio::error_code error, size_t bytes) = 0;
+
+    protected:
+        Socket_handler() = default;
+        ~Socket_handler() = default;
+
+        Socket_handler(const Socket_handler&) = default;
+        Socket_handler(Socket_handler&&) = default;
+
+        Socket_handler& operator=(const Socket_handler&) = default;
+        Socket_handler& operator=(Socket_handler&&) = default;
+    };
+} // namespace Net
@@ -1,7 +1,10 @@
 #pragma once
 
-#include "../Events/Delegate.h"
 #include "../Utility/Common.h"
+#include "Socket_handler.h"
+#include "Socket_options.h"
+#include <functional>
+#include <memory>
 
 namespace Net
 {
@@ -15,7 +18,13 @@ namespace Net
     {
     public:
         Socket_interface() = default;
-        virtual ~Socket_interface() = default;
+
+        // The derived sockets have already cancelled their operations so their completions are dropped
+        virtual ~Socket_interface()
+        {
+            if (m_is_alive != nullptr)
+                *m_is_alive = false;
+        }
 
         Socket_interface(const Socket_interface&) = delete;
         Socket_interface(Socket_interface&&) = default;
@@ -23,6 +32,12 @@ namespace Net
         Socket_interface& operator=(const Socket_interface&) = delete;
         Socket_interface& operator=(Socket_interface&&) = default;
 
+        // Handler gets the completions of the operations. Should be set before any operation is started.
+        void set_handler(Socket_handler* handler) noexcept
+        {
+            m_handler = handler;
+        }
+
         virtual void async_handshake(Handshake_type type) = 0;
 
         virtual void async_read_header(void* buffer, size_t size) = 0;
@@ -32,14 +47,24 @@ namespace Net
 
         [[nodiscard]] virtual bool is_open() const = 0;
         [[nodiscard]] virtual std::string get_ip() const = 0;
+
+        // Remote address without formatting it. Unspecified if the socket does not use ip.
+        [[nodiscard]] virtual asio::ip::address get_address() const = 0;
         virtual void disconnect() = 0;
 
-        Delegate<asio::error_code> m_handshake_finished;
-        Delegate<asio::error_code, size_t> m_read_header_finished;
-        Delegate<asio::error_code, size_t> m_read_body_finished;
-        Delegate<asio::error_code, size_t> m_write_header_finished;
-        Delegate<asio::error_code, size_t> m_write_body_finished;
+        // Should be called from the thread that handles this socket
+        virtual asio::error_code set_options(const Socket_options& options) = 0;
+
+        // Runs the function on the thread that handles this socket
+        virtual void post(std::function<void()> function) = 0;
+
+        // Executor of the thread that handles this socket
+        [[nodiscard]] virtual asio::any_io_executor get_executor() = 0;
+
+    protected:
+        Socket_handler* m_handler = nullptr;
 
-    private:
+        // Completions that run after the socket and its handler are destroyed check this
+        std::shared_ptr<bool> m_is_alive = std::make_shared<bool>(true);
     };
 } // namespace Net
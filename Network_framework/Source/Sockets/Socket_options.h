@@ -0,0 +1,164 @@
+#pragma once
+
+#include "../Utility/Common.h"
+#include <chrono>
+#include <optional>
+#include <type_traits>
+
+namespace Net
+{
+    /**
+     *   Options applied to the sockets of the connections. Options without value are left to the system defaults.
+     *   Options that are not supported by the platform are ignored.
+     */
+    struct Socket_options
+    {
+        // Disables Nagle's algorithm. Header and body are written separately so this is on by default.
+        std::optional<bool> m_no_delay = true;
+
+        // Disables delayed acks. Linux only and the system can turn it back off.
+        std::optional<bool> m_quick_ack;
+
+        std::optional<int> m_send_buffer_size;
+        std::optional<int> m_receive_buffer_size;
+
+        std::optional<bool> m_keep_alive;
+        std::optional<std::chrono::seconds> m_keep_alive_idle;
+        std::optional<std::chrono::seconds> m_keep_alive_interval;
+        std::optional<int> m_keep_alive_count;
+
+        // How long the receive can busy poll the device. Linux only.
+        std::optional<std::chrono::microseconds> m_busy_poll;
+
+        // Limits the unsent bytes in the socket send buffer. Linux and macOS only.
+        std::optional<int> m_not_sent_low_water;
+
+        // IP_TOS for IPv4 and IPV6_TCLASS for IPv6
+        std::optional<int> m_type_of_service;
+    };
+
+    // Integer socket option that Asio does not have
+    template <int Level, int Name>
+    class Integer_socket_option
+    {
+    public:
+        explicit Integer_socket_option(int value) noexcept : m_value(value)
+        {
+        }
+
+        template <typename Protocol_type>
+        [[nodiscard]] int level(const Protocol_type&) const noexcept
+        {
+            return Level;
+        }
+
+        template <typename Protocol_type>
+        [[nodiscard]] int name(const Protocol_type&) const noexcept
+        {
+            return Name;
+        }
+
+        template <typename Protocol_type>
+        [[nodiscard]] const int* data(const Protocol_type&) const noexcept
+        {
+            return &m_value;
+        }
+
+        template <typename Protocol_type>
+        [[nodiscard]] size_t size(const Protocol_type&) const noexcept
+        {
+            return sizeof(m_value);
+        }
+
+    private:
+        int m_value = 0;
+    };
+
+    /**
+     *   Sets the options on the socket
+     *
+     *   @param the socket to set options on
+     *   @param the options
+     *   @return the first error that happened or empty error code
+     */
+    template <typename Asio_socket>
+    asio::error_code apply_socket_options(Asio_socket& socket, const Socket_options& options)
+    {
+        asio::error_code first_error;
+
+        auto set_option = [&socket, &first_error](const auto& option) {
+            asio::error_code error;
+            socket.set_option(option, error);
+
+            if (error && !first_error)
+                first_error = error;
+        };
+
+        if (options.m_send_buffer_size.has_value())
+            set_option(asio::socket_base::send_buffer_size(options.m_send_buffer_size.value()));
+
+        if (options.m_receive_buffer_size.has_value())
+            set_option(asio::socket_base::receive_buffer_size(options.m_receive_buffer_size.value()));
+
+        // Rest of the options are only for tcp sockets
+        if constexpr (std::is_same_v<typename Asio_socket::protocol_type, Protocol>)
+        {
+            if (options.m_no_delay.has_value())
+                set_option(Protocol::no_delay(options.m_no_delay.value()));
+
+            if (options.m_keep_alive.has_value())
+                set_option(asio::socket_base::keep_alive(options.m_keep_alive.value()));
+
+#if defined(TCP_KEEPIDLE)
+            if (options.m_keep_alive_idle.has_value())
+                set_option(Integer_socket_option<IPPROTO_TCP, TCP_KEEPIDLE>(
+                    static_cast<int>(options.m_keep_alive_idle.value().count())));
+#elif defined(TCP_KEEPALIVE)
+            if (options.m_keep_alive_idle.has_value())
+                set_option(Integer_socket_option<IPPROTO_TCP, TCP_KEEPALIVE>(
+                    static_cast<int>(options.m_keep_alive_idle.value().count())));
+#endif
+
+#if defined(TCP_KEEPINTVL)
+            if (options.m_keep_alive_interval.has_value())
+                set_option(Integer_socket_option<IPPROTO_TCP, TCP_KEEPINTVL>(
+                    static_cast<int>(options.m_keep_alive_interval.value().count())));
+#endif
+
+#if defined(TCP_KEEPCNT)
+            if (options.m_keep_alive_count.has_value())
+                set_option(Integer_socket_option<IPPROTO_TCP, TCP_KEEPCNT>(options.m_keep_alive_count.value()));
+#endif
+
+#if defined(TCP_QUICKACK)
+            if (options.m_quick_ack.has_value())
+                set_option(Integer_socket_option<IPPROTO_TCP, TCP_QUICKACK>(options.m_quick_ack.value() ? 1 : 0));
+#endif
+
+#if defined(SO_BUSY_POLL)
+            if (options.m_busy_poll.has_value())
+                set_option(Integer_socket_option<SOL_SOCKET, SO_BUSY_POLL>(
+                    static_cast<int>(options.m_busy_poll.value().count())));
+#endif
+
+#if defined(TCP_NOTSENT_LOWAT)
+            if (options.m_not_sent_low_water.has_value())
+                set_option(
+                    Integer_socket_option<IPPROTO_TCP, TCP_NOTSENT_LOWAT>(options.m_not_sent_low_water.value()));
+#endif
+
+            if (options.m_type_of_service.has_value())
+            {
+                asio::error_code error;
+                const bool is_v6 = socket.local_endpoint(error).protocol() == Protocol::v6();
+
+                if (is_v6)
+                    set_option(Integer_socket_option<IPPROTO_IPV6, IPV6_TCLASS>(options.m_type_of_service.value()));
+                else
+                    set_option(Integer_socket_option<IPPROTO_IP, IP_TOS>(options.m_type_of_service.value()));
+            }
+        }
+
+        return first_error;
+    }
+} // namespace Net
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "../Utility/Common.h"
+#include "../Utility/Timer_wheel.h"
+#include <memory>
 
 namespace Net
 {
@@ -13,14 +15,37 @@ namespace Net
             return Protocol::resolver(m_asio_context);
         }
 
-        [[nodiscard]] Protocol::acceptor create_acceptor(const Protocol::endpoint& endpoint)
+        template <typename Endpoint>
+        [[nodiscard]] auto create_acceptor(const Endpoint& endpoint)
         {
-            return Protocol::acceptor(m_asio_context, endpoint);
+            return typename Endpoint::protocol_type::acceptor(m_asio_context, endpoint);
         }
 
-        [[nodiscard]] Protocol::socket create_socket()
+        template <typename Asio_protocol = Protocol>
+        [[nodiscard]] typename Asio_protocol::socket create_socket()
         {
-            return Protocol::socket(m_asio_context);
+            return typename Asio_protocol::socket(m_asio_context);
+        }
+
+        [[nodiscard]] asio::any_io_executor get_executor()
+        {
+            return m_asio_context.get_executor();
+        }
+
+        // Timers of the wheel should only be used from the Asio thread
+        [[nodiscard]] Timer_wheel& get_timer_wheel() noexcept
+        {
+            return m_timer_wheel;
+        }
+
+        /**
+         *   Destroys the object in the Asio thread so it can't be destroyed while the Asio thread is using it.
+         *   If the Asio thread is not running the object is destroyed when it starts again or with the Asio context.
+         */
+        template <typename Object>
+        void destroy_in_asio_thread(std::unique_ptr<Object> object)
+        {
+            asio::post(m_asio_context, [destroyed_object = std::move(object)] {});
         }
 
         /**
@@ -36,6 +61,7 @@ namespace Net
                     m_asio_context.restart();
 
                 m_asio_thread_stop_flag = false;
+                m_timer_wheel.start();
                 m_asio_thread_handle = std::thread([this] { asio_thread(); });
             }
             else
@@ -52,6 +78,8 @@ namespace Net
 
                 if (m_asio_thread_handle.joinable())
                     m_asio_thread_handle.join();
+
+                m_timer_wheel.stop();
             }
         }
 
@@ -64,6 +92,7 @@ namespace Net
         }
 
         asio::io_context m_asio_context;
+        Timer_wheel m_timer_wheel = Timer_wheel(m_asio_context);
         std::thread m_asio_thread_handle;
         bool m_asio_thread_stop_flag = true;
     };
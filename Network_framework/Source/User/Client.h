@@ -1,19 +1,48 @@
 #pragma once
 
+#include "../Sockets/Loopback_socket.h"
+#include "../Sockets/Shared_memory_socket.h"
 #include "../Utility/Thread_safe_deque.h"
 #include "User.h"
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace Net
 {
+    // Delays between the reconnect attempts double after each failed attempt until they reach the max delay
+    struct Reconnect_options
+    {
+        std::chrono::milliseconds m_initial_delay = std::chrono::milliseconds(100);
+        std::chrono::milliseconds m_max_delay = std::chrono::seconds(10);
+
+        // Zero means no limit
+        size_t m_max_attempts = 0;
+    };
+
     template <Id_concept Id_type>
     class Client : public User<Id_type>
     {
     public:
         using Optional_seconds = std::optional<std::chrono::seconds>;
+        using Milliseconds = std::chrono::milliseconds;
+
+        // Gets asio::error::timed_out or asio::error::not_connected if the request failed
+        using Response_handler = std::function<void(asio::error_code, Message<Id_type>)>;
 
-        Client() : m_temp_socket(this->create_socket())
+        Client()
+            : m_temp_socket(this->create_socket()),
+              m_temp_local_socket(this->template create_socket<Local_protocol>())
         {
             
         }
@@ -21,6 +50,7 @@ namespace Net
         ~Client() override
         {
             disconnect();
+            this->stop_message_workers();
         }
 
         Client(const Client&) = delete;
@@ -39,27 +69,118 @@ namespace Net
                 m_has_received_server_data = false;
                 Protocol::resolver resolver = this->create_resolver();
                 auto endpoints = resolver.resolve(host, port);
-                async_connect(endpoints);
 
-                this->start_asio_thread();
+                // Reconnecting uses the same endpoints so it does not block on resolving them again
+                start_connecting([this, endpoints] { async_connect(endpoints); });
+            }
+            catch (const std::exception& exception)
+            {
+                this->notifications_push_back(
+                    Notification{.m_code = Notification_code::connect_exception, .m_severity = Severity::error}
+                        .set_text(exception.what()));
+                return false;
+            }
+
+            return true;
+        }
+
+        // Connects to the server in the same machine through unix domain socket
+        bool connect(const Local_protocol::endpoint& endpoint)
+        {
+            try
+            {
+                m_has_received_server_data = false;
+                start_connecting([this, endpoint] { async_connect(endpoint); });
             }
             catch (const std::exception& exception)
             {
-                this->notifications_push_back(std::format("Exception: {}", exception.what()), Severity::error);
+                this->notifications_push_back(
+                    Notification{.m_code = Notification_code::connect_exception, .m_severity = Severity::error}
+                        .set_text(exception.what()));
                 return false;
             }
 
             return true;
         }
 
+        // Connects to the server in the same process through loopback socket without the kernel
+        bool connect(Loopback_acceptor& acceptor)
+        {
+            try
+            {
+                m_has_received_server_data = false;
+
+                if (!acceptor.is_accepting())
+                    throw std::runtime_error("Server is not accepting loopback connections");
+
+                start_connecting([this, &acceptor] { connect_loopback(acceptor); });
+            }
+            catch (const std::exception& exception)
+            {
+                this->notifications_push_back(
+                    Notification{.m_code = Notification_code::connect_exception, .m_severity = Severity::error}
+                        .set_text(exception.what()));
+                return false;
+            }
+
+            return true;
+        }
+
+#if defined(__linux__)
+        // Connects to the server in the same machine through shared memory that the server has at the path
+        bool connect_shared_memory(const std::string& path)
+        {
+            try
+            {
+                m_has_received_server_data = false;
+                start_connecting([this, path] { async_connect_shared_memory(Local_protocol::endpoint(path)); });
+            }
+            catch (const std::exception& exception)
+            {
+                this->notifications_push_back(
+                    Notification{.m_code = Notification_code::connect_exception, .m_severity = Severity::error}
+                        .set_text(exception.what()));
+                return false;
+            }
+
+            return true;
+        }
+#endif
+
         void disconnect()
         {
+            m_should_reconnect = false;
             this->stop_asio_thread();
+            m_new_sockets.clear();
 
             if (is_connected())
                 m_connection->disconnect();
 
             m_connection.reset();
+            m_is_session_connected = false;
+            m_reconnect_timer.reset();
+            m_is_reconnect_pending = false;
+            stop_resuming();
+            fail_pending_requests();
+        }
+
+        /**
+         *   Reconnects when the connection is lost and continues the session if the server has enabled sessions.
+         *   Messages sent while reconnecting and the ones the server did not receive are written after reconnecting.
+         *   Should be called before connecting.
+         *
+         *   @param the delays between the attempts. Each delay has random jitter so the clients don't reconnect at
+         *   the same time.
+         */
+        void enable_reconnect(Reconnect_options options = {}) noexcept
+        {
+            m_reconnect_options = options;
+        }
+
+        // Id that the server has given to this client
+        [[nodiscard]] uint32_t get_client_id() const noexcept
+        {
+            return m_remote_id;
         }
 
         [[nodiscard]] bool is_connected() const
@@ -83,22 +204,459 @@ namespace Net
         {
             User<Id_type>::update(max_items, wait, check_connections_interval);
 
+            handle_new_connection();
             handle_received_messages(max_items);
+            check_connection_lost();
+            check_reconnect();
+        }
+
+        // Latency to the server measured with the pings
+        [[nodiscard]] Latency_information get_latency_information() const
+        {
+            if (m_connection)
+                return m_connection->get_latency_information();
+
+            return {};
+        }
+
+        // Counters of the client and its connection to the server. Doesn't stop the Asio thread.
+        [[nodiscard]] Metrics_snapshot<Id_type> get_metrics() const
+        {
+            Metrics_snapshot<Id_type> snapshot = this->create_metrics_snapshot();
+
+            if (m_connection)
+                snapshot.m_connections.push_back(m_connection->get_metrics());
+
+            return snapshot;
+        }
+
+        // Estimated time of the server clock
+        [[nodiscard]] std::chrono::system_clock::time_point get_server_time() const
+        {
+            using namespace std::chrono;
+
+            const auto clock_offset = get_latency_information().m_clock_offset;
+            return system_clock::now() + duration_cast<system_clock::duration>(clock_offset);
         }
 
-        // Sends the message to the server or does nothing if not connected
+        // Sends the message to the server or does nothing if not connected. Kept until reconnected if reconnecting.
         void send_message(Message<Id_type> message)
         {
-            if (is_connected())
-                m_connection->send_message(std::move(message));
+            try_send_message(std::move(message));
+        }
+
+        /**
+         *   Asks the server to send the messages it publishes to the topic. The server can deny it.
+         *   Subscriptions are kept when the session is resumed.
+         */
+        void subscribe(uint64_t topic)
+        {
+            try_send_message(Message_converter<Id_type>::create_subscribe(Topic_data{.m_topic = topic}));
+        }
+
+        void unsubscribe(uint64_t topic)
+        {
+            try_send_message(Message_converter<Id_type>::create_unsubscribe(Topic_data{.m_topic = topic}));
         }
 
-        // You can only start sending messages to server after this event
+        /**
+         *   Sends the request without waiting for the earlier responses. The server answers with send_response.
+         *   The handler is called from the Asio thread, from the update if the session is lost or right away if the
+         *   client is not connected.
+         *
+         *   @param the request
+         *   @param the handler for the response
+         *   @param time after the request fails. Zero waits until the response arrives or the session is lost.
+         */
+        void send_request(Message<Id_type> request, Response_handler handler, Milliseconds timeout = {})
+        {
+            uint32_t correlation_id = m_next_correlation_id++;
+
+            // Zero is not used since the messages that are not requests have it
+            if (correlation_id == 0)
+                correlation_id = m_next_correlation_id++;
+
+            request.set_rpc(Rpc_type::request, correlation_id);
+
+            {
+                std::scoped_lock lock(m_requests_mutex);
+                auto& pending_request = m_pending_requests[correlation_id];
+                pending_request = std::make_unique<Pending_request>();
+                pending_request->m_handler = std::move(handler);
+            }
+
+            if (!try_send_message(std::move(request)))
+            {
+                complete_request(correlation_id, asio::error::not_connected, {});
+                return;
+            }
+
+            if (timeout > Milliseconds::zero())
+                asio::post(this->get_executor(), [this, correlation_id, timeout] {
+                    arm_request_timeout(correlation_id, timeout);
+                });
+        }
+
+        /**
+         *   Sends the request and gives the response through the future
+         *
+         *   @param the request
+         *   @param time after the request fails. Zero waits until the response arrives or the session is lost.
+         *   @return the response. Throws std::system_error if the request failed.
+         */
+        [[nodiscard]] std::future<Message<Id_type>> send_request(Message<Id_type> request, Milliseconds timeout = {})
+        {
+            auto promise = std::make_shared<std::promise<Message<Id_type>>>();
+            auto future = promise->get_future();
+
+            send_request(
+                std::move(request),
+                [promise](asio::error_code error, Message<Id_type> response) {
+                    if (error)
+                        promise->set_exception(std::make_exception_ptr(std::system_error(error)));
+                    else
+                        promise->set_value(std::move(response));
+                },
+                timeout);
+
+            return future;
+        }
+
+        /**
+         *   Sends the request and resumes the coroutine in its own executor when the response arrives
+         *
+         *   @param the request
+         *   @param time after the request fails. Zero waits until the response arrives or the session is lost.
+         *   @return the response
+         *   @throws std::system_error if the request failed
+         */
+        asio::awaitable<Message<Id_type>> async_request(Message<Id_type> request, Milliseconds timeout = {})
+        {
+            auto awaited_response = std::make_shared<Awaited_response>(co_await asio::this_coro::executor);
+
+            send_request(
+                std::move(request),
+                [awaited_response](asio::error_code error, Message<Id_type> response) {
+                    asio::post(awaited_response->m_signal.get_executor(),
+                               [awaited_response, error, response = std::move(response)]() mutable {
+                                   awaited_response->m_error = error;
+                                   awaited_response->m_response = std::move(response);
+                                   awaited_response->m_is_done = true;
+                                   awaited_response->m_signal.cancel();
+                               });
+                },
+                timeout);
+
+            while (!awaited_response->m_is_done)
+            {
+                asio::error_code wait_error;
+                co_await awaited_response->m_signal.async_wait(asio::redirect_error(asio::use_awaitable, wait_error));
+            }
+
+            if (awaited_response->m_error)
+                throw std::system_error(awaited_response->m_error);
+
+            co_return std::move(awaited_response->m_response);
+        }
+
+        /**
+         *   You can only start sending messages to server after this event.
+         *   Also broadcast after reconnecting if the earlier session could not be continued.
+         */
         Delegate<> m_on_connected;
 
+        // The connection was restored and the session continued with the same id
+        Delegate<> m_on_reconnected;
+
+        // The connection to the server was lost. Not broadcast when the client disconnects itself.
+        Delegate<> m_on_disconnected;
+
         Delegate<Message<Id_type>> m_on_message;
 
+    protected:
+        bool should_stop_waiting() override
+        {
+            return User<Id_type>::should_stop_waiting() || !m_new_sockets.empty();
+        }
+
     private:
+        // Request that is waiting for the response
+        struct Pending_request
+        {
+            Response_handler m_handler;
+            Timer_wheel::Timer m_timeout_timer;
+        };
+
+        // Response that the coroutine waits for in its executor
+        struct Awaited_response
+        {
+            explicit Awaited_response(const asio::any_io_executor& executor)
+                : m_signal(executor, asio::steady_timer::time_point::max())
+            {
+            }
+
+            asio::steady_timer m_signal;
+            asio::error_code m_error;
+            Message<Id_type> m_response;
+            bool m_is_done = false;
+        };
+
+        // Returns false if the message could not be sent or kept for sending after reconnecting
+        bool try_send_message(Message<Id_type> message)
+        {
+            if (m_is_resuming || (m_should_reconnect && !is_connected()))
+                m_held_messages.push_back(std::move(message));
+
+            else if (is_connected())
+                m_connection->send_message(std::move(message));
+
+            else
+                return false;
+
+            return true;
+        }
+
+        bool handle_response(Message<Id_type>& response) override
+        {
+            complete_request(response.get_correlation_id(), asio::error_code(), std::move(response));
+            return true;
+        }
+
+        // Called from the Asio thread. The timer wheel can only be used there.
+        void arm_request_timeout(uint32_t correlation_id, Milliseconds timeout)
+        {
+            std::scoped_lock lock(m_requests_mutex);
+
+            auto found_request = m_pending_requests.find(correlation_id);
+            if (found_request == m_pending_requests.end())
+                return;
+
+            Timer_wheel::Timer& timer = found_request->second->m_timeout_timer;
+            timer.m_on_expired.set_callback(
+                [this, correlation_id] { complete_request(correlation_id, asio::error::timed_out, {}); });
+
+            this->get_timer_wheel().schedule(timer, timeout);
+        }
+
+        // Calls the handler of the request if it is still waiting. Late responses are ignored.
+        void complete_request(uint32_t correlation_id, asio::error_code error, Message<Id_type> response)
+        {
+            std::unique_ptr<Pending_request> request;
+
+            {
+                std::scoped_lock lock(m_requests_mutex);
+
+                auto found_request = m_pending_requests.find(correlation_id);
+                if (found_request == m_pending_requests.end())
+                    return;
+
+                request = std::move(found_request->second);
+                m_pending_requests.erase(found_request);
+            }
+
+            request->m_handler(error, std::move(response));
+
+            // The timer might be the one calling this so it is destroyed after
+            this->destroy_in_asio_thread(std::move(request));
+        }
+
+        // Called when the Asio thread is not running
+        void fail_pending_requests()
+        {
+            std::unordered_map<uint32_t, std::unique_ptr<Pending_request>> requests;
+
+            {
+                std::scoped_lock lock(m_requests_mutex);
+                requests.swap(m_pending_requests);
+            }
+
+            for (const auto& [correlation_id, request] : requests)
+                request->m_handler(asio::error::not_connected, {});
+        }
+
+        /**
+         *   Fails the requests that were sent through the lost connection. The held requests are kept since they
+         *   are sent after reconnecting. Can be called while the Asio thread is running.
+         */
+        void fail_sent_requests()
+        {
+            std::unordered_set<uint32_t> held_requests;
+            for (const Message<Id_type>& message : m_held_messages)
+            {
+                if (message.get_rpc_type() == Rpc_type::request)
+                    held_requests.insert(message.get_correlation_id());
+            }
+
+            std::vector<uint32_t> failed_requests;
+            {
+                std::scoped_lock lock(m_requests_mutex);
+
+                for (const auto& [correlation_id, request] : m_pending_requests)
+                {
+                    if (!held_requests.contains(correlation_id))
+                        failed_requests.push_back(correlation_id);
+                }
+            }
+
+            for (const uint32_t correlation_id : failed_requests)
+                complete_request(correlation_id, asio::error::connection_aborted, {});
+        }
+
+        // The function connects from the Asio thread. It is also used for reconnecting.
+        void start_connecting(std::function<void()> connect_function)
+        {
+            m_connect_function = std::move(connect_function);
+            m_session = m_reconnect_options.has_value() ? std::make_shared<Session_state<Id_type>>() : nullptr;
+            m_session_token = 0;
+            stop_resuming();
+
+            asio::post(this->get_executor(), m_connect_function);
+            this->start_asio_thread();
+        }
+
+        // Called from the Asio thread when the socket has connected. The connection is created in the update.
+        void set_connection(std::unique_ptr<Socket_interface> socket)
+        {
+            m_reconnect_attempt = 0;
+            m_new_sockets.push_back(std::move(socket));
+            this->notify_wait();
+        }
+
+        template <typename Asio_socket>
+        void set_connection(Asio_socket socket)
+        {
+            set_connection(this->make_socket_interface(std::move(socket)));
+        }
+
+        // Called from the Asio thread. Tries again later if this was a reconnect attempt.
+        void on_connect_failed(Notification_code reason, asio::error_code error = {})
+        {
+            this->notifications_push_back({.m_code = reason, .m_severity = Severity::error, .m_error = error});
+
+            if (m_is_reconnect_pending)
+                schedule_reconnect();
+        }
+
+        void connect_loopback(Loopback_acceptor& acceptor)
+        {
+            std::unique_ptr<Socket_interface> socket = acceptor.connect(this->get_executor());
+
+            if (socket != nullptr)
+                set_connection(std::move(socket));
+            else
+                on_connect_failed(Notification_code::loopback_not_accepting);
+        }
+
+        /**
+         *   The connection is only replaced in the thread calling update so it can be used there without locking.
+         *   Reconnecting stays pending until here so the update doesn't start another attempt in between.
+         */
+        void handle_new_connection()
+        {
+            while (!m_new_sockets.empty())
+            {
+                if (m_connection)
+                    this->destroy_in_asio_thread(std::move(m_connection));
+
+                m_connection =
+                    this->create_connection(m_new_sockets.pop_front(), 0, Handshake_type::client, m_session);
+                m_is_reconnect_pending = false;
+            }
+        }
+
+        void check_connection_lost()
+        {
+            if (m_is_session_connected && !is_connected())
+            {
+                m_is_session_connected = false;
+
+                // Without reconnecting the responses can't arrive anymore
+                if (!m_should_reconnect)
+                    fail_sent_requests();
+
+                m_on_disconnected.broadcast();
+            }
+        }
+
+        // Starts reconnecting if the connection of the session was lost
+        void check_reconnect()
+        {
+            if (!m_should_reconnect)
+            {
+                // Reconnecting gave up so the held requests are not sent either
+                if (m_is_resuming && !m_is_reconnect_pending)
+                {
+                    stop_resuming();
+                    fail_sent_requests();
+                }
+
+                return;
+            }
+
+            if (m_is_reconnect_pending || is_connected())
+                return;
+
+            this->notifications_push_back(Notification_code::reconnecting, Severity::error);
+
+            m_is_reconnect_pending = true;
+            m_is_resuming = true;
+
+            // The connection moves its unsent messages to the session when it is destroyed
+            this->destroy_in_asio_thread(std::move(m_connection));
+            asio::post(this->get_executor(), [this] { schedule_reconnect(); });
+        }
+
+        // Waits with exponential backoff and jitter before the next attempt. Called from the Asio thread.
+        void schedule_reconnect()
+        {
+            const Reconnect_options& options = m_reconnect_options.value();
+
+            if (options.m_max_attempts != 0 && m_reconnect_attempt >= options.m_max_attempts)
+            {
+                this->notifications_push_back(
+                    {.m_code = Notification_code::reconnect_gave_up,
+                     .m_severity = Severity::error,
+                     .m_value = m_reconnect_attempt});
+
+                m_should_reconnect = false;
+                m_is_reconnect_pending = false;
+                return;
+            }
+
+            auto delay = options.m_initial_delay;
+            for (size_t i = 0; i < m_reconnect_attempt && delay < options.m_max_delay; ++i)
+                delay *= 2;
+
+            delay = std::min(delay, options.m_max_delay);
+            ++m_reconnect_attempt;
+
+            std::uniform_int_distribution<int64_t> jitter(delay.count() / 2, delay.count());
+            m_reconnect_timer.emplace(this->get_executor(), std::chrono::milliseconds(jitter(m_jitter_generator)));
+
+            m_reconnect_timer->async_wait([this](asio::error_code error) {
+                if (!error && m_is_reconnect_pending)
+                    m_connect_function();
+            });
+        }
+
+        // Writes the messages that were sent while reconnecting. They are held again if the connection was lost.
+        void finish_resuming()
+        {
+            m_is_resuming = false;
+
+            auto held_messages = std::move(m_held_messages);
+            m_held_messages.clear();
+
+            for (Message<Id_type>& message : held_messages)
+                send_message(std::move(message));
+        }
+
+        void stop_resuming()
+        {
+            m_is_resuming = false;
+            m_held_messages.clear();
+        }
+
         void async_connect(Protocol::resolver::results_type endpoints)
         {
             m_temp_socket = this->create_socket();
@@ -106,15 +664,46 @@ namespace Net
                 m_temp_socket, endpoints,
                 [this](asio::error_code error, const Protocol::endpoint& endpoint) {
                     if (!error)
-                    {
-                        m_connection = this->create_connection(std::move(m_temp_socket), 0, Handshake_type::client);
-                    }
+                        set_connection(std::move(m_temp_socket));
                     else
-                        this->notifications_push_back(
-                            std::format("Error on connection because {}", error.message()), Severity::error);
+                        on_connect_failed(Notification_code::connect_failed, error);
                 });
         }
 
+        void async_connect(const Local_protocol::endpoint& endpoint)
+        {
+            m_temp_local_socket = this->template create_socket<Local_protocol>();
+            m_temp_local_socket.async_connect(endpoint, [this](asio::error_code error) {
+                if (!error)
+                    set_connection(std::move(m_temp_local_socket));
+                else
+                    on_connect_failed(Notification_code::connect_failed, error);
+            });
+        }
+
+#if defined(__linux__)
+        void async_connect_shared_memory(const Local_protocol::endpoint& endpoint)
+        {
+            m_temp_local_socket = this->template create_socket<Local_protocol>();
+            m_temp_local_socket.async_connect(endpoint, [this](asio::error_code error) {
+                if (error)
+                {
+                    on_connect_failed(Notification_code::connect_failed, error);
+                    return;
+                }
+
+                async_open_shared_memory_socket(
+                    std::move(m_temp_local_socket),
+                    [this](asio::error_code error, std::unique_ptr<Socket_interface> socket) {
+                        if (!error)
+                            set_connection(std::move(socket));
+                        else
+                            on_connect_failed(Notification_code::shared_memory_failed, error);
+                    });
+            });
+        }
+#endif
+
         // Triggers the on message callback for all the received messages
         void handle_received_messages(size_t max_messages)
         {
@@ -123,19 +712,65 @@ namespace Net
                 auto owned_message = this->in_queue_pop_front();
 
                 if (owned_message.m_message.get_internal_id() == Internal_id::not_internal)
-                    m_on_message.broadcast(std::move(owned_message.m_message));
+                    handle_message(std::move(owned_message));
                 else
                     handle_internal_message(std::move(owned_message));
             }
         }
 
+        void handle_message(Owned_message<Id_type> message) override
+        {
+            m_on_message.broadcast(std::move(message.m_message));
+        }
+
         void handle_server_data(const Server_data& data)
+        {
+            // Asks to continue the earlier session. The new session is used if the server rejects it.
+            if (m_is_resuming && m_session_token != 0)
+            {
+                m_offered_session = data;
+                m_connection->request_session_resume(m_remote_id, m_session_token);
+                return;
+            }
+
+            // The connection has already dropped the session if the server does not keep it
+            start_session(data);
+        }
+
+        void start_session(const Server_data& data)
         {
             m_remote_id = data.m_client_id;
+            m_session_token = data.m_session_token;
             m_has_received_server_data = true;
+            m_should_reconnect = m_reconnect_options.has_value();
+            m_is_session_connected = true;
+
+            // The new session does not have the requests of the earlier one
+            if (m_is_resuming)
+                fail_sent_requests();
+
+            finish_resuming();
             m_on_connected.broadcast();
         }
 
+        // The connection has already replayed the messages or started the new session
+        void handle_session_resumed(const Session_resumed_data& data)
+        {
+            if (!data.m_is_resumed)
+            {
+                this->notifications_push_back(Notification_code::session_not_continued, Severity::error);
+                start_session(m_offered_session);
+                return;
+            }
+
+            m_remote_id = data.m_client_id;
+            m_is_session_connected = true;
+            finish_resuming();
+
+            this->notifications_push_back({.m_code = Notification_code::session_continued, .m_value = m_remote_id});
+            m_on_reconnected.broadcast();
+        }
+
         // Handles the message that is internal to the framework
         void handle_internal_message(Owned_message<Id_type> owned_message)
         {
@@ -146,15 +781,48 @@ namespace Net
             case Internal_id::server_accept:
                 handle_server_data(Message_converter<Id_type>::extract_server_accept(message));
                 break;
+            case Internal_id::session_resumed:
+                handle_session_resumed(Message_converter<Id_type>::extract_session_resumed(message));
+                break;
             default:
                 break;
             }
         }
 
         Protocol::socket m_temp_socket;
+        Local_protocol::socket m_temp_local_socket;
         std::unique_ptr<Connection<Id_type>> m_connection;
 
+        // Sockets connected in the Asio thread that are waiting for the update to create their connection
+        Thread_safe_deque<std::unique_ptr<Socket_interface>> m_new_sockets;
+
         uint32_t m_remote_id = 0;
         bool m_has_received_server_data = false;
+
+        // True from m_on_connected or m_on_reconnected until the connection is lost
+        bool m_is_session_connected = false;
+
+        // Connects again with the same arguments. Used from the Asio thread.
+        std::function<void()> m_connect_function;
+
+        // Reconnecting and the session. The session and the attempt state are only used from the Asio thread.
+        std::optional<Reconnect_options> m_reconnect_options;
+        std::shared_ptr<Session_state<Id_type>> m_session = nullptr;
+        uint64_t m_session_token = 0;
+        Server_data m_offered_session;
+
+        std::atomic<bool> m_should_reconnect = false;
+        std::atomic<bool> m_is_reconnect_pending = false;
+        bool m_is_resuming = false;
+        std::deque<Message<Id_type>> m_held_messages;
+
+        std::optional<asio::steady_timer> m_reconnect_timer;
+        size_t m_reconnect_attempt = 0;
+        std::mt19937 m_jitter_generator{std::random_device()()};
+
+        // Requests by their correlation ids. Responses are handled in the Asio thread.
+        std::unordered_map<uint32_t, std::unique_ptr<Pending_request>> m_pending_requests;
+        std::mutex m_requests_mutex;
+        std::atomic<uint32_t> m_next_correlation_id = 1;
     };
 } // namespace Net
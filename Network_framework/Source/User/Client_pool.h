@@ -0,0 +1,175 @@
+#pragma once
+
+#include "Client.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Many connections to the same server that are used as one. Each connection has its own client and
+     *   Asio thread so the connections can use more bandwidth and cores than one connection.
+     *   The server sees every connection as a different client.
+     */
+    template <Id_concept Id_type, typename Client_type = Client<Id_type>>
+    class Client_pool
+    {
+    public:
+        /**
+         *   @param how many connections the pool has
+         *   @throws if the connection count is zero
+         */
+        explicit Client_pool(size_t connection_count)
+        {
+            if (connection_count == 0)
+                throw std::invalid_argument("Client pool needs at least one connection");
+
+            for (size_t i = 0; i < connection_count; ++i)
+            {
+                auto& client = m_clients.emplace_back(std::make_unique<Client_type>());
+
+                client->m_on_connected.set_callback([this, i] { on_client_connected(i); });
+                client->m_on_reconnected.set_callback([this, i] { on_client_connected(i); });
+                client->m_on_disconnected.set_callback([this, i] { on_client_disconnected(i); });
+                client->m_on_message.set_callback(
+                    [this](Message<Id_type> message) { m_on_message.broadcast(std::move(message)); });
+            }
+
+            m_is_client_connected.resize(connection_count, false);
+        }
+
+        Client_pool(const Client_pool&) = delete;
+        Client_pool(Client_pool&&) = delete;
+
+        ~Client_pool() = default;
+
+        Client_pool& operator=(const Client_pool&) = delete;
+        Client_pool& operator=(Client_pool&&) = delete;
+
+        /**
+         *   Connects all the connections. Takes the same arguments as Client::connect.
+         *
+         *   @return false if any of the connections could not be started
+         */
+        template <typename... Argument_types>
+        bool connect(Argument_types&&... arguments)
+        {
+            reset_connected_states();
+            bool is_started = true;
+
+            for (const auto& client : m_clients)
+                is_started &= client->connect(arguments...);
+
+            return is_started;
+        }
+
+        void disconnect()
+        {
+            for (const auto& client : m_clients)
+                client->disconnect();
+
+            reset_connected_states();
+        }
+
+        // True when all the connections are connected
+        [[nodiscard]] bool is_connected() const
+        {
+            for (const auto& client : m_clients)
+                if (!client->is_connected())
+                    return false;
+
+            return true;
+        }
+
+        /**
+         *   Updates all the connections. Does not wait since the connections are waited separately.
+         *
+         *   @param The max items handled for each connection
+         */
+        void update(size_t max_items = SIZE_T_MAX)
+        {
+            for (const auto& client : m_clients)
+                client->update(max_items);
+        }
+
+        // Sends the messages to the connections in turns. The messages can arrive in different order.
+        void send_message(Message<Id_type> message)
+        {
+            const size_t index = m_next_client.fetch_add(1) % m_clients.size();
+            m_clients[index]->send_message(std::move(message));
+        }
+
+        /**
+         *   Sends the message through the connection of the key.
+         *   The messages with the same key arrive in the same order they were sent.
+         *
+         *   @param the key that selects the connection
+         *   @param the message
+         */
+        void send_message(size_t key, Message<Id_type> message)
+        {
+            m_clients[key % m_clients.size()]->send_message(std::move(message));
+        }
+
+        [[nodiscard]] size_t get_connection_count() const noexcept
+        {
+            return m_clients.size();
+        }
+
+        /**
+         *   For setting up the connections before connecting.
+         *   The pool uses their m_on_connected, m_on_reconnected, m_on_disconnected and m_on_message.
+         */
+        [[nodiscard]] Client_type& get_client(size_t index)
+        {
+            return *m_clients.at(index);
+        }
+
+        // Broadcast when all the connections have connected. Also broadcast again after the lost ones are restored.
+        Delegate<> m_on_connected;
+
+        // Broadcast when a connection is lost while all the connections were connected
+        Delegate<> m_on_disconnected;
+
+        // Messages from all the connections
+        Delegate<Message<Id_type>> m_on_message;
+
+    private:
+        // The clients are updated from the same thread so their callbacks don't need locking
+        void on_client_connected(size_t index)
+        {
+            if (m_is_client_connected[index])
+                return;
+
+            m_is_client_connected[index] = true;
+
+            if (++m_connected_count == m_clients.size())
+                m_on_connected.broadcast();
+        }
+
+        void on_client_disconnected(size_t index)
+        {
+            if (!m_is_client_connected[index])
+                return;
+
+            m_is_client_connected[index] = false;
+
+            if (m_connected_count-- == m_clients.size())
+                m_on_disconnected.broadcast();
+        }
+
+        void reset_connected_states()
+        {
+            std::fill(m_is_client_connected.begin(), m_is_client_connected.end(), false);
+            m_connected_count = 0;
+        }
+
+        std::vector<std::unique_ptr<Client_type>> m_clients;
+        std::atomic<size_t> m_next_client = 0;
+        std::vector<bool> m_is_client_connected;
+        size_t m_connected_count = 0;
+    };
+} // namespace Net
@@ -1,28 +1,59 @@
 #pragma once
 
+#include "../Sockets/Acceptor.h"
+#include "../Sockets/Loopback_socket.h"
+#include "../Sockets/Shared_memory_socket.h"
+#include "../Utility/Interest_grid.h"
+#include "../Utility/Ip_range_table.h"
+#include "../Utility/Slot_map.h"
 #include "User.h"
+#include <algorithm>
 #include <cstdint>
-#include <format>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
 namespace Net
 {
+    // Identifies the request that the response is sent to
+    struct Request_handle
+    {
+        uint32_t m_client_id = 0;
+        uint32_t m_correlation_id = 0;
+    };
+
     template <Id_concept Id_type>
     class Server : public User<Id_type>
     {
     public:
-        using Optional_seconds = std::optional<std::chrono::seconds>;
+        using Seconds = std::chrono::seconds;
+        using Optional_seconds = std::optional<Seconds>;
+        using Async_message_handler = std::function<asio::awaitable<void>(Client_information, Message<Id_type>)>;
+
+        explicit Server(uint16_t port)
+        {
+            add_endpoint(Protocol::endpoint(Protocol::v4(), port));
+        }
 
-        explicit Server(uint16_t port) : m_acceptor(this->create_acceptor(Protocol::endpoint(Protocol::v4(), port)))
+        // Server for the connections in the same machine through unix domain socket
+        explicit Server(const Local_protocol::endpoint& endpoint)
         {
+            add_endpoint(endpoint);
         }
 
         virtual ~Server()
         {
             stop();
+            this->stop_message_workers();
         }
 
         Server(const Server&) = delete;
@@ -30,27 +61,144 @@ namespace Net
         Server& operator=(const Server&) = delete;
         Server& operator=(Server&&) = delete;
 
+        /**
+         *   Starts listening also to this endpoint. Should be called before the server is started.
+         *
+         *   @param tcp or unix domain socket endpoint
+         *   @throws if the endpoint can't be listened to or its path is a file that is not a socket
+         */
+        template <typename Endpoint>
+        void add_endpoint(const Endpoint& endpoint)
+        {
+            using Asio_protocol = typename Endpoint::protocol_type;
+            using Asio_socket = typename Asio_protocol::socket;
+
+            if constexpr (std::is_same_v<Asio_protocol, Local_protocol>)
+                remove_stale_socket_file(endpoint.path());
+
+            auto acceptor = std::make_unique<Template_acceptor<Asio_protocol>>(
+                this->create_acceptor(endpoint),
+                [this](Asio_socket socket) { return this->make_socket_interface(std::move(socket)); });
+
+            acceptor->m_on_accepted.set_callback(this, &Server<Id_type>::on_socket_accepted);
+            m_acceptors.push_back(std::move(acceptor));
+        }
+
+        /**
+         *   Starts accepting clients in the same process that connect through loopback sockets.
+         *   Should be called before the server is started.
+         *
+         *   @param how many bytes can be buffered in each direction
+         *   @return the acceptor that the clients connect to. It lives as long as the server.
+         */
+        Loopback_acceptor& add_loopback_endpoint(size_t capacity = Loopback_socket::DEFAULT_CAPACITY)
+        {
+            auto acceptor = std::make_unique<Loopback_acceptor>(this->get_executor(), capacity);
+            Loopback_acceptor& acceptor_reference = *acceptor;
+
+            acceptor->m_on_accepted.set_callback(this, &Server<Id_type>::on_socket_accepted);
+            m_acceptors.push_back(std::move(acceptor));
+            return acceptor_reference;
+        }
+
+#if defined(__linux__)
+        /**
+         *   Starts listening to clients in the same machine that connect through shared memory.
+         *   The clients connect to the unix domain socket in the path and the regions are created next to it.
+         *   Should be called before the server is started.
+         *
+         *   @param path of the unix domain socket
+         *   @param capacity of the ring in each direction
+         *   @throws if the path can't be listened to or it is a file that is not a socket
+         */
+        void add_shared_memory_endpoint(const std::string& path,
+                                        uint64_t ring_capacity = Shared_memory_region::DEFAULT_RING_CAPACITY)
+        {
+            const Local_protocol::endpoint endpoint(path);
+            remove_stale_socket_file(endpoint.path());
+
+            auto acceptor =
+                std::make_unique<Shared_memory_acceptor>(this->create_acceptor(endpoint), path, ring_capacity);
+
+            acceptor->m_on_accepted.set_callback(this, &Server<Id_type>::on_socket_accepted);
+            m_acceptors.push_back(std::move(acceptor));
+        }
+#endif
+
+        /**
+         *   Keeps the session of the client that lost the connection so it can reconnect and continue with the same id.
+         *   Messages sent to the client meanwhile and the ones it did not receive are written after it reconnects.
+         *   m_on_client_disconnect is broadcast when the session ends. Should be called before the server is started.
+         *
+         *   @param how long the session is kept after the connection was lost
+         */
+        void enable_sessions(Seconds resume_window) noexcept
+        {
+            m_session_resume_window = resume_window;
+        }
+
+        /**
+         *   Enables send_message_to_clients_near. The clients are added to the grid with set_client_position.
+         *
+         *   @param width of a grid cell. Use about the usual radius of the messages.
+         *   @throws if the cell size is not positive
+         */
+        void enable_interest_grid(float cell_size)
+        {
+            m_interest_grid.emplace(cell_size);
+        }
+
+        /**
+         *   For the enter and leave events of the cells
+         *
+         *   @throws if the interest grid has not been enabled
+         */
+        [[nodiscard]] Interest_grid& get_interest_grid()
+        {
+            if (!m_interest_grid)
+                throw std::logic_error("Interest grid has not been enabled");
+
+            return *m_interest_grid;
+        }
+
+        /**
+         *   The client is removed from the grid when it disconnects or loses the connection
+         *
+         *   @throws if the interest grid has not been enabled or the position is not finite
+         */
+        void set_client_position(uint32_t client_id, Position position)
+        {
+            if (m_clients.contains(client_id))
+                get_interest_grid().set_position(client_id, position);
+        }
+
         bool start()
         {
             try
             {
-                async_wait_for_connections();
+                apply_ip_filter_changes();
+
+                for (const auto& acceptor : m_acceptors)
+                    acceptor->async_accept();
+
                 this->start_asio_thread();
             }
             catch (const std::exception& exception)
             {
-                this->notifications_push_back(std::format("Server start error: {}", exception.what()), Severity::error);
+                this->notifications_push_back(
+                    Notification{.m_code = Notification_code::server_start_failed, .m_severity = Severity::error}
+                        .set_text(exception.what()));
                 return false;
             }
 
-            this->notifications_push_back("Server has been started");
+            this->notifications_push_back(Notification_code::server_started);
             return true;
         }
 
         void stop()
         {
             this->stop_asio_thread();
-            this->notifications_push_back("Server has been stopped");
+            this->notifications_push_back(Notification_code::server_stopped);
         }
 
         /**
@@ -64,26 +212,85 @@ namespace Net
             size_t max_handled_items = SIZE_T_MAX, bool wait = false,
             Optional_seconds check_connections_interval = Optional_seconds()) override
         {
+            m_update_thread_id.store(std::this_thread::get_id(), std::memory_order_relaxed);
+            apply_ip_filter_changes();
             User<Id_type>::update(max_handled_items, wait, check_connections_interval);
 
             handle_received_messages(max_handled_items);
+            handle_queued_responses(max_handled_items);
             handle_new_connections(max_handled_items);
+            handle_expired_sessions();
+            this->poll_handler_context();
+        }
+
+        /**
+         *   Handles the messages with the coroutine instead of m_on_message. While the coroutine of a client is
+         *   suspended the later messages of the client wait for it but the other clients are still handled.
+         *   The coroutines run in the thread calling update and update with wait also wakes up when they can continue.
+         *   Only works with the queued message dispatch. Should be called before the server is started.
+         *
+         *   @param the coroutine called for each message and request. It can await anything in the handler context.
+         *   @throws if the message dispatch is not queued
+         */
+        void set_async_message_handler(Async_message_handler handler)
+        {
+            this->enable_handler_context();
+            m_async_message_handler = std::move(handler);
+        }
+
+        // Executor for the things the asynchronous handlers await. Only valid after set_async_message_handler.
+        [[nodiscard]] asio::io_context::executor_type get_handler_executor()
+        {
+            return this->get_handler_context()->get_executor();
+        }
+
+        // How many clients have a suspended asynchronous handler
+        [[nodiscard]] size_t get_suspended_client_count() const noexcept
+        {
+            return m_suspended_clients.size();
         }
 
         // Gets information about spesific client.
         Client_information get_client_information(uint32_t client_id) const
         {
-            auto found_client = m_clients.find(client_id);
+            const Client_data* client = m_clients.find(client_id);
 
-            if (found_client == m_clients.end())
+            if (client == nullptr)
                 return {};
 
-            auto& connection_ref = found_client->second.m_connection;
+            auto& connection_ref = client->m_connection;
             Client_information information = { connection_ref->get_id(), connection_ref->get_ip() };
+            information.m_latency = connection_ref->get_latency_information();
 
             return information;
         }
 
+        // Counters of the client. Empty if there is no client with the id.
+        [[nodiscard]] Connection_metrics_snapshot<Id_type> get_client_metrics(uint32_t client_id) const
+        {
+            const Client_data* client = m_clients.find(client_id);
+
+            if (client == nullptr)
+                return {};
+
+            return client->m_connection->get_metrics();
+        }
+
+        /**
+         *   Counters of the server and all the connected clients. The connections keep counting while this
+         *   reads them so the Asio thread is never stopped. Should be called from the thread calling update.
+         */
+        [[nodiscard]] Metrics_snapshot<Id_type> get_metrics()
+        {
+            Metrics_snapshot<Id_type> snapshot = this->create_metrics_snapshot();
+            snapshot.m_connections.reserve(m_clients.size());
+
+            for (const Client_data& client : m_clients)
+                snapshot.m_connections.push_back(client.m_connection->get_metrics());
+
+            return snapshot;
+        }
+
         /*
         *   Sets max allowed connections to server at same time.
         *   This will not disconnect any already connected clients.
@@ -93,55 +300,240 @@ namespace Net
             m_max_connections = new_max_connections;
         }
 
-        void ban_ip(const std::string& new_banned_ip)
+        /**
+         *   Denies the connections from the address or the network. They are denied before the address is formatted.
+         *   The changes to the bans and the allowed addresses are applied when the server starts and on the update
+         *   so many of them can be changed at once.
+         *
+         *   @param address like "10.0.0.1" or network like "10.0.0.0/8" or "2001:db8::/32"
+         *   @throws if it is not valid address or network
+         */
+        void ban_ip(std::string_view banned_network)
+        {
+            std::scoped_lock lock(m_ip_filter_mutex);
+            m_banned_ips.add(banned_network);
+            m_is_ip_filter_changed = true;
+        }
+
+        // Bans the network without parsing it. Use prefix length 32 or 128 for single address.
+        void ban_ip(const asio::ip::address& banned_network, uint8_t prefix_length)
+        {
+            std::scoped_lock lock(m_ip_filter_mutex);
+            m_banned_ips.add(banned_network, prefix_length);
+            m_is_ip_filter_changed = true;
+        }
+
+        // Removes the ban that was added with the same address or network. Each ban has to be removed separately.
+        void unban_ip(std::string_view unbanned_network)
+        {
+            std::scoped_lock lock(m_ip_filter_mutex);
+            m_banned_ips.remove(unbanned_network);
+            m_is_ip_filter_changed = true;
+        }
+
+        void unban_ip(const asio::ip::address& unbanned_network, uint8_t prefix_length)
+        {
+            std::scoped_lock lock(m_ip_filter_mutex);
+            m_banned_ips.remove(unbanned_network, prefix_length);
+            m_is_ip_filter_changed = true;
+        }
+
+        /**
+         *   When any address or network is allowed the connections from the others are denied.
+         *   Bans are checked also for the allowed ones. Connections that don't use ip are not filtered.
+         *
+         *   @param address like "10.0.0.1" or network like "10.0.0.0/8" or "2001:db8::/32"
+         *   @throws if it is not valid address or network
+         */
+        void allow_ip(std::string_view allowed_network)
+        {
+            std::scoped_lock lock(m_ip_filter_mutex);
+            m_allowed_ips.add(allowed_network);
+            m_is_ip_filter_changed = true;
+        }
+
+        void disallow_ip(std::string_view disallowed_network)
         {
-            m_banned_ip.insert(new_banned_ip);
+            std::scoped_lock lock(m_ip_filter_mutex);
+            m_allowed_ips.remove(disallowed_network);
+            m_is_ip_filter_changed = true;
         }
 
-        void unban_ip(const std::string& new_unbanned_ip)
+        // Overrides the socket options for the client
+        void set_client_socket_options(uint32_t client_id, Socket_options options)
         {
-            m_banned_ip.erase(new_unbanned_ip);
+            if (Client_data* client = m_clients.find(client_id))
+                client->m_connection->set_socket_options(std::move(options));
         }
 
+        // Disconnects the client and ends its session
         void disconnect_client(uint32_t client_id)
         {
-            auto found_client = m_clients.find(client_id);
+            if (m_clients.contains(client_id))
+                remove_client(client_id);
+
+            auto found_session = m_detached_sessions.find(client_id);
 
-            if (found_client != m_clients.end())
-                remove_client(found_client);
+            if (found_session != m_detached_sessions.end())
+                end_session(found_session);
         }
 
+        // Messages to the client that is reconnecting are written after it has reconnected
         void send_message_to_client(uint32_t client_id, Message<Id_type> message)
         {
-            auto found_client = m_clients.find(client_id);
-            if (found_client == m_clients.end())
-                return;
+            if (Client_data* client = m_clients.find(client_id))
+            {
+                if (client->m_connection->is_connected())
+                {
+                    send_to_client(*client, std::move(message));
+                    return;
+                }
+
+                drop_client(client_id);
+            }
+
+            auto found_session = m_detached_sessions.find(client_id);
+
+            if (found_session != m_detached_sessions.end())
+                keep_for_session(found_session->second, std::move(message));
+        }
 
-            const auto& connection_ptr = found_client->second.m_connection;
+        /**
+         *   Answers to the request. Can be answered later and in any order.
+         *   Can be called from any thread. When it is not called from the thread running the update, like from the
+         *   direct or worker dispatch, the response is sent by the next update.
+         */
+        void send_response(const Request_handle& request, Message<Id_type> response)
+        {
+            response.set_rpc(Rpc_type::response, request.m_correlation_id);
 
-            if (connection_ptr->is_connected())
-                connection_ptr->send_message(std::move(message));
+            // The clients can only be looked up in the thread running the update
+            if (std::this_thread::get_id() == m_update_thread_id.load(std::memory_order_relaxed))
+                send_message_to_client(request.m_client_id, std::move(response));
             else
-                remove_client(found_client);
+            {
+                m_queued_responses.push_back({request.m_client_id, std::move(response)});
+                this->notify_wait();
+            }
+        }
+
+        /**
+         *   Adds the client to the topic. Clients can also subscribe themselves with Client::subscribe.
+         *
+         *   @return false if the client does not exist
+         */
+        bool subscribe(uint32_t client_id, uint64_t topic)
+        {
+            Client_data* client = m_clients.find(client_id);
+            if (client == nullptr)
+                return false;
+
+            add_to_topic(client_id, *client, topic);
+            return true;
+        }
+
+        void unsubscribe(uint32_t client_id, uint64_t topic)
+        {
+            if (Client_data* client = m_clients.find(client_id))
+                remove_from_topic(client_id, client->m_topics, topic);
+        }
+
+        /**
+         *   Sends the message to every subscriber of the topic.
+         *   Subscribers that are reconnecting get the message after they have reconnected.
+         *
+         *   @param the topic
+         *   @param the message
+         *   @param the client that does not get the message. Usually the one who sent it.
+         */
+        void publish(uint64_t topic, const Message<Id_type>& message, uint32_t ignored_client = 0)
+        {
+            Fan_out fan_out(message);
+
+            auto found_topic = m_topics.find(topic);
+            if (found_topic != m_topics.end())
+            {
+                for (const uint32_t subscriber_id : found_topic->second)
+                {
+                    if (subscriber_id == ignored_client)
+                        continue;
+
+                    // Subscribers that are reconnecting stay in the topic and get the message through the session
+                    if (const Client_data* client = m_clients.find(subscriber_id))
+                        add_recipient(fan_out, *client);
+                    else
+                        add_recipient(fan_out, m_detached_sessions.at(subscriber_id));
+                }
+            }
+
+            send_fan_out(std::move(fan_out));
+        }
+
+        // Includes the subscribers that are reconnecting
+        [[nodiscard]] size_t get_subscriber_count(uint64_t topic) const
+        {
+            auto found_topic = m_topics.find(topic);
+            return found_topic != m_topics.end() ? found_topic->second.size() : 0;
+        }
+
+        /**
+         *   Sends the message only to the clients within the radius instead of all of them
+         *
+         *   @param the center
+         *   @param the radius
+         *   @param the message
+         *   @param the client that does not get the message. Usually the one who sent it.
+         *   @throws if the interest grid has not been enabled or the position or the radius is not valid
+         */
+        void send_message_to_clients_near(
+            Position position, float radius, const Message<Id_type>& message, uint32_t ignored_client = 0)
+        {
+            Fan_out fan_out(message);
+
+            get_interest_grid().for_each_near(position, radius, [&](uint32_t client_id) {
+                if (client_id == ignored_client)
+                    return;
+
+                if (const Client_data* client = m_clients.find(client_id))
+                    add_recipient(fan_out, *client);
+            });
+
+            send_fan_out(std::move(fan_out));
         }
 
+        /**
+         *   Sends the message to all the clients. The clients share one copy of the message
+         *   and the Asio thread gets the ones that need to be sent from it with one post.
+         *
+         *   @param the message
+         *   @param the client that does not get the message. Usually the one who sent it.
+         */
         void send_message_to_all_clients(const Message<Id_type>& message, uint32_t ignored_client = 0)
         {
-            auto client_iterator = m_clients.begin();
-            while (client_iterator != m_clients.end())
+            Fan_out fan_out(message);
+
+            // Dropping moves the last client to the current index
+            size_t index = 0;
+            while (index < m_clients.size())
             {
-                const auto& connection = client_iterator->second.m_connection;
+                const uint32_t client_id = m_clients.handle_at(index);
 
-                if (connection->is_connected())
+                if (m_clients.value_at(index).m_connection->is_connected())
                 {
-                    if (connection->get_id() != ignored_client)
-                        connection->send_message(message);
+                    if (client_id != ignored_client)
+                        add_recipient(fan_out, m_clients.value_at(index));
 
-                    ++client_iterator;
+                    ++index;
                 }
                 else
-                    client_iterator = remove_client(client_iterator);
+                    drop_client(client_id);
             }
+
+            for (auto& [client_id, session] : m_detached_sessions)
+                if (client_id != ignored_client)
+                    add_recipient(fan_out, session);
+
+            send_fan_out(std::move(fan_out));
         }
 
         /** T
@@ -153,20 +545,80 @@ namespace Net
         Delegate<const Client_information&> m_on_client_disconnect;
         Delegate<const Client_information&, Message<Id_type>> m_on_message;
 
+        // Requests are given to m_on_message if this has not been set
+        Delegate<const Client_information&, Message<Id_type>, Request_handle> m_on_request;
+
+        // Allows you to deny the client from subscribing to the topic
+        Delegate<const Client_information&, uint64_t, bool&> m_on_subscribe;
+
     protected:
         bool should_stop_waiting() override
         {
             const bool parent_conditions = User<Id_type>::should_stop_waiting();
 
-            return parent_conditions || !m_new_connections.empty();
+            return parent_conditions || !m_new_connections.empty() || !m_queued_responses.empty();
         }
 
     private:
         struct Client_data
         {
             std::unique_ptr<Connection<Id_type>> m_connection = nullptr;
+            std::shared_ptr<Session_state<Id_type>> m_session = nullptr;
+            uint64_t m_session_token = 0;
+
+            // Topics that have this client in their subscribers
+            std::vector<uint64_t> m_topics = {};
+        };
+
+        // Session of the client that lost the connection and can still reconnect
+        struct Detached_session
+        {
+            std::shared_ptr<Session_state<Id_type>> m_session;
+            uint64_t m_session_token = 0;
+            std::string m_ip;
+            asio::ip::address m_address;
+            std::chrono::steady_clock::time_point m_expiry_time;
+
+            // The client stays in the subscribers of these topics until the session ends
+            std::vector<uint64_t> m_topics;
+        };
+
+        // Response that was sent outside the update
+        struct Queued_response
+        {
+            uint32_t m_client_id = 0;
+            Message<Id_type> m_response;
+        };
+
+        // Recipients of one message that is sent to many clients
+        struct Fan_out
+        {
+            explicit Fan_out(const Message<Id_type>& message)
+                : m_message(std::make_shared<const Message<Id_type>>(message))
+            {
+            }
+
+            Shared_message<Id_type> m_message;
+
+            // Written from the Asio thread since they have sessions
+            std::vector<Connection<Id_type>*> m_connections;
+            std::vector<std::shared_ptr<Session_state<Id_type>>> m_sessions;
         };
 
+        // Removes the socket file left by the earlier run. Other files are never removed.
+        static void remove_stale_socket_file(const std::string& path)
+        {
+            const std::filesystem::file_status status = std::filesystem::symlink_status(path);
+
+            if (!std::filesystem::exists(status))
+                return;
+
+            if (!std::filesystem::is_socket(status))
+                throw std::runtime_error("Endpoint path " + path + " is a file that is not a socket");
+
+            std::filesystem::remove(path);
+        }
+
         // Triggers the on message callback for the every message
         void handle_received_messages(size_t max_messages)
         {
@@ -175,18 +627,299 @@ namespace Net
                 Owned_message<Id_type> owned_message = this->in_queue_pop_front();
 
                 if (owned_message.m_message.get_internal_id() == Internal_id::not_internal)
-                    m_on_message.broadcast(
-                        std::move(owned_message.m_client_information), std::move(owned_message.m_message));
+                    handle_message(std::move(owned_message));
                 else
                     handle_internal_message(std::move(owned_message));
             }
         }
 
+        void handle_message(Owned_message<Id_type> message) override
+        {
+            if (m_async_message_handler)
+                start_async_handler(std::move(message));
+
+            else if (message.m_message.get_rpc_type() == Rpc_type::request && m_on_request.has_been_set())
+            {
+                const Request_handle request = {message.get_client_id(), message.m_message.get_correlation_id()};
+                m_on_request.broadcast(message.get_client_information(), std::move(message.m_message), request);
+            }
+
+            else
+                m_on_message.broadcast(message.get_client_information(), std::move(message.m_message));
+        }
+
+        // Runs the handler now or after the earlier handler of the same client has finished
+        void start_async_handler(Owned_message<Id_type> message)
+        {
+            const uint32_t client_id = message.get_client_id();
+            auto found_client = m_suspended_clients.find(client_id);
+
+            if (found_client != m_suspended_clients.end())
+                found_client->second.push_back(std::move(message));
+            else
+            {
+                m_suspended_clients.emplace(client_id, std::deque<Owned_message<Id_type>>());
+                run_async_handler(std::move(message));
+            }
+        }
+
+        void run_async_handler(Owned_message<Id_type> message)
+        {
+            const uint32_t client_id = message.get_client_id();
+
+            auto handler = m_async_message_handler(message.get_client_information(), std::move(message.m_message));
+
+            asio::co_spawn(*this->get_handler_context(), std::move(handler),
+                           [this, client_id](std::exception_ptr exception) {
+                               on_async_handler_finished(client_id, exception);
+                           });
+        }
+
+        // Starts the next message of the client if it has any
+        void on_async_handler_finished(uint32_t client_id, std::exception_ptr exception)
+        {
+            if (exception)
+            {
+                Notification notification = {
+                    .m_code = Notification_code::message_handler_failed,
+                    .m_severity = Severity::error,
+                    .m_client_id = client_id};
+
+                try
+                {
+                    std::rethrow_exception(exception);
+                }
+                catch (const std::exception& error)
+                {
+                    notification.set_text(error.what());
+                }
+                catch (...)
+                {
+                }
+
+                this->notifications_push_back(notification);
+            }
+
+            auto found_client = m_suspended_clients.find(client_id);
+            if (found_client == m_suspended_clients.end())
+                return;
+
+            auto& waiting_messages = found_client->second;
+            if (waiting_messages.empty())
+            {
+                m_suspended_clients.erase(found_client);
+                return;
+            }
+
+            Owned_message<Id_type> next_message = std::move(waiting_messages.front());
+            waiting_messages.pop_front();
+            run_async_handler(std::move(next_message));
+        }
+
         // Handles messages internal to framework
         void handle_internal_message(Owned_message<Id_type> message)
         {
-            // Currently we have no internal messages in the server so this must be invalid message
-            disconnect_client(message.m_client_information.m_id);
+            const uint32_t client_id = message.get_client_id();
+
+            switch (message.m_message.get_internal_id())
+            {
+            case Internal_id::session_resume:
+                handle_session_resume(client_id, Message_converter<Id_type>::extract_session_resume(message.m_message));
+                break;
+            case Internal_id::subscribe:
+                handle_subscribe(message.get_client_information(),
+                                 Message_converter<Id_type>::extract_topic(message.m_message));
+                break;
+            case Internal_id::unsubscribe:
+                unsubscribe(client_id, Message_converter<Id_type>::extract_topic(message.m_message).m_topic);
+                break;
+
+            // Other internal messages are not sent to the server so this must be invalid message
+            default:
+                disconnect_client(client_id);
+                break;
+            }
+        }
+
+        void handle_subscribe(const Client_information& information, const Topic_data& data)
+        {
+            if (!m_clients.contains(information.m_id))
+                return;
+
+            bool is_allowed = true;
+            m_on_subscribe.broadcast(information, data.m_topic, is_allowed);
+
+            // The callback might have disconnected the client
+            Client_data* client = m_clients.find(information.m_id);
+            if (is_allowed && client != nullptr)
+                add_to_topic(information.m_id, *client, data.m_topic);
+        }
+
+        void add_to_topic(uint32_t client_id, Client_data& client, uint64_t topic)
+        {
+            if (std::ranges::find(client.m_topics, topic) != client.m_topics.end())
+                return;
+
+            client.m_topics.push_back(topic);
+            m_topics[topic].push_back(client_id);
+        }
+
+        /**
+         *   Swaps the client with the last subscriber so the subscribers stay dense
+         *
+         *   @param the client or the detached session
+         *   @param the topics the client has subscribed to
+         *   @param the topic
+         */
+        void remove_from_topic(uint32_t client_id, std::vector<uint64_t>& client_topics, uint64_t topic)
+        {
+            auto found_topic = std::ranges::find(client_topics, topic);
+            if (found_topic == client_topics.end())
+                return;
+
+            *found_topic = client_topics.back();
+            client_topics.pop_back();
+
+            auto& subscribers = m_topics.at(topic);
+            *std::ranges::find(subscribers, client_id) = subscribers.back();
+            subscribers.pop_back();
+
+            if (subscribers.empty())
+                m_topics.erase(topic);
+        }
+
+        void remove_from_interest_grid(uint32_t client_id)
+        {
+            if (m_interest_grid)
+                m_interest_grid->remove(client_id);
+        }
+
+        void remove_from_topics(uint32_t client_id, std::vector<uint64_t>& client_topics)
+        {
+            while (!client_topics.empty())
+                remove_from_topic(client_id, client_topics, client_topics.back());
+        }
+
+        /**
+         *   Moves the connection of the reconnected client to its earlier session if the token matches.
+         *   Otherwise the client continues with the new session it got when it connected.
+         *
+         *   @param the id the client got when it connected
+         *   @param the session the client wants to continue
+         */
+        void handle_session_resume(uint32_t client_id, const Session_resume_data& data)
+        {
+            if (!m_clients.contains(client_id))
+                return;
+
+            // The earlier connection can still look connected if it was lost without closing
+            const Client_data* earlier_client = m_clients.find(data.m_client_id);
+            if (earlier_client != nullptr && data.m_client_id != client_id && data.m_session_token != 0 &&
+                earlier_client->m_session_token == data.m_session_token)
+                detach_client(data.m_client_id);
+
+            Client_data& found_client = *m_clients.find(client_id);
+
+            auto found_session = m_detached_sessions.find(data.m_client_id);
+            if (found_session == m_detached_sessions.end() || data.m_session_token == 0 ||
+                found_session->second.m_session_token != data.m_session_token)
+            {
+                this->notifications_push_back(
+                    {.m_code = Notification_code::session_resume_failed,
+                     .m_severity = Severity::error,
+                     .m_client_id = client_id,
+                     .m_value = data.m_client_id});
+                found_client.m_connection->reject_session_resume();
+                return;
+            }
+
+            // The client continues with the id of the session and the id it got when it connected is freed
+            remove_from_topics(client_id, found_client.m_topics);
+            remove_from_interest_grid(client_id);
+            Client_data client = std::move(found_client);
+            m_clients.erase(client_id);
+
+            client.m_session = std::move(found_session->second.m_session);
+            client.m_session_token = found_session->second.m_session_token;
+            client.m_connection->resume_session(data.m_client_id, client.m_session, data.m_received_count);
+
+            // The session id is still in the subscribers of its topics
+            client.m_topics = std::move(found_session->second.m_topics);
+            m_detached_sessions.erase(found_session);
+
+            // The id of the detached session was kept reserved for this
+            m_clients.insert_at(data.m_client_id, std::move(client));
+
+            this->notifications_push_back(
+                {.m_code = Notification_code::session_resumed, .m_client_id = client_id, .m_value = data.m_client_id});
+        }
+
+        // Ends the sessions whose clients did not reconnect in time
+        void handle_expired_sessions()
+        {
+            const auto now = std::chrono::steady_clock::now();
+
+            auto session_iterator = m_detached_sessions.begin();
+            while (session_iterator != m_detached_sessions.end())
+            {
+                if (session_iterator->second.m_expiry_time <= now)
+                    session_iterator = end_session(session_iterator);
+                else
+                    ++session_iterator;
+            }
+        }
+
+        // Messages to the clients with sessions are sent from the Asio thread so they stay after the replayed ones
+        void send_to_client(const Client_data& client, Message<Id_type> message)
+        {
+            if (client.m_session == nullptr)
+            {
+                client.m_connection->send_message(std::move(message));
+                return;
+            }
+
+            // The connection is destroyed in the Asio thread after this has run
+            asio::post(this->get_executor(),
+                       [connection = client.m_connection.get(), message = std::move(message)]() mutable {
+                           connection->send_message(std::move(message));
+                       });
+        }
+
+        // Clients without a session get the message right away like in send_to_client
+        void add_recipient(Fan_out& fan_out, const Client_data& client)
+        {
+            if (client.m_session == nullptr)
+                client.m_connection->send_message(fan_out.m_message);
+            else
+                fan_out.m_connections.push_back(client.m_connection.get());
+        }
+
+        void add_recipient(Fan_out& fan_out, const Detached_session& session)
+        {
+            fan_out.m_sessions.push_back(session.m_session);
+        }
+
+        // Gives the rest of the recipients to the Asio thread with one post instead of one for each client
+        void send_fan_out(Fan_out fan_out)
+        {
+            if (fan_out.m_connections.empty() && fan_out.m_sessions.empty())
+                return;
+
+            asio::post(this->get_executor(), [fan_out = std::move(fan_out)] {
+                for (Connection<Id_type>* connection : fan_out.m_connections)
+                    connection->send_message(fan_out.m_message);
+
+                for (const auto& session : fan_out.m_sessions)
+                    session->m_unsent.push_back(fan_out.m_message);
+            });
+        }
+
+        // The message is written when the client has reconnected. Session is only used in the Asio thread.
+        void keep_for_session(const Detached_session& session, Message<Id_type> message)
+        {
+            asio::post(this->get_executor(), [session = session.m_session, message = std::move(message)]() mutable {
+                session->m_unsent.push_back(std::move(message));
+            });
         }
 
         /**
@@ -200,89 +933,219 @@ namespace Net
                 create_client(m_new_connections.pop_front());
         }
 
+        void handle_queued_responses(size_t max_amount)
+        {
+            for (size_t i = 0; i < max_amount && !m_queued_responses.empty(); ++i)
+            {
+                Queued_response queued_response = m_queued_responses.pop_front();
+                send_message_to_client(queued_response.m_client_id, std::move(queued_response.m_response));
+            }
+        }
+
         // Prepares the client for receiving messages
-        void setup_client(std::unique_ptr<Connection<Id_type>> connection, uint32_t unique_id)
+        void setup_client(std::unique_ptr<Connection<Id_type>> connection, uint32_t unique_id,
+                          std::shared_ptr<Session_state<Id_type>> session, uint64_t session_token)
         {
-            auto accept_message = Message_converter<Id_type>::create_server_accept({unique_id});
+            auto accept_message = Message_converter<Id_type>::create_server_accept({unique_id, session_token});
             connection->send_message(accept_message);
 
-            Client_data client = {std::move(connection)};
-            m_clients.emplace(unique_id, std::move(client));
+            Client_data client = {std::move(connection), std::move(session), session_token};
+            m_clients.insert_at(unique_id, std::move(client));
+        }
+
+        // Unpredictable token that the client needs to know to resume the session. Zero is not used.
+        [[nodiscard]] uint64_t create_session_token()
+        {
+            uint64_t token = 0;
+
+            while (token == 0)
+                token = (static_cast<uint64_t>(m_token_source()) << 32) | m_token_source();
+
+            return token;
         }
 
         // Adds the new socket as connection
-        void create_client(Protocol::socket socket)
+        void create_client(std::unique_ptr<Socket_interface> socket)
         {
-            if (!socket.is_open())
+            if (!socket->is_open())
                 return;
 
-            const uint32_t client_id = m_id_counter++;
-            const std::string client_ip = socket.remote_endpoint().address().to_string();
+            const std::string client_ip = socket->get_ip();
+            uint32_t client_id = 0;
+
+            try
+            {
+                client_id = m_clients.reserve();
+            }
+            catch (const std::length_error&)
+            {
+                this->notifications_push_back(
+                    {.m_code = Notification_code::too_many_clients, .m_address = socket->get_address()});
+                return;
+            }
 
             bool client_accepted = true;
             m_on_client_connect.broadcast(Client_information(client_id, client_ip), client_accepted);
 
             if (client_accepted)
             {
-                auto new_connection = this->create_connection(std::move(socket), client_id, Handshake_type::server);
+                std::shared_ptr<Session_state<Id_type>> session = nullptr;
+                uint64_t session_token = 0;
+
+                if (m_session_resume_window.has_value())
+                {
+                    session = std::make_shared<Session_state<Id_type>>();
+                    session_token = create_session_token();
+                }
 
                 this->notifications_push_back(
-                    std::format("Client with ip {} was accepted and assigned ip {} to it", client_ip, client_id));
+                    {.m_code = Notification_code::client_accepted,
+                     .m_client_id = client_id,
+                     .m_address = socket->get_address()});
+
+                auto new_connection =
+                    this->create_connection(std::move(socket), client_id, Handshake_type::server, session);
 
-                setup_client(std::move(new_connection), client_id);
+                setup_client(std::move(new_connection), client_id, std::move(session), session_token);
             }
             else
-                this->notifications_push_back(std::format("Connection {} denied", client_ip));
+            {
+                m_clients.release(client_id);
+                this->notifications_push_back(
+                    {.m_code = Notification_code::client_denied, .m_address = socket->get_address()});
+            }
         }
 
-        // Primes the Asio thread to wait for the connections in async way
-        void async_wait_for_connections()
+        // Event when any of the acceptors accepted new socket. Called from the Asio thread.
+        void on_socket_accepted(asio::error_code error, std::unique_ptr<Socket_interface> socket)
         {
-            m_acceptor.async_accept([this](asio::error_code error, Protocol::socket socket) {
-                if (!error)
-                {
-                    const std::string ip = socket.remote_endpoint().address().to_string();
-                    this->notifications_push_back(std::format("Server new connection: {}", ip));
-
-                    if (m_clients.size() + m_new_connections.size() >= m_max_connections)
-                        this->notifications_push_back("Max connections reached");
+            if (!error)
+            {
+                // Denied connections are checked first since there can be a lot of them
+                if (m_clients.size() + m_new_connections.size() >= m_max_connections)
+                    this->notifications_push_back(Notification_code::max_connections_reached);
 
-                    else if (m_banned_ip.contains(ip))
-                        this->notifications_push_back(std::format("Client with ip {} is banned", ip));
+                else if (!is_address_allowed(socket->get_address()))
+                    this->notifications_push_back(
+                        {.m_code = Notification_code::address_banned, .m_address = socket->get_address()});
 
-                    else
-                    {
-                        m_new_connections.push_back(std::move(socket));
-                        this->notify_wait();
-                    }
-                }
                 else
+                {
                     this->notifications_push_back(
-                        std::format("Server connection error: {}", error.message()), Severity::error);
+                        {.m_code = Notification_code::new_connection, .m_address = socket->get_address()});
 
-                async_wait_for_connections();
-            });
+                    m_new_connections.push_back(std::move(socket));
+                    this->notify_wait();
+                }
+            }
+            else
+                this->notifications_push_back(
+                    {.m_code = Notification_code::accept_failed, .m_severity = Severity::error, .m_error = error});
+        }
+
+        // Rebuilds the tables here so the checks in the Asio thread don't sort or lock
+        void apply_ip_filter_changes()
+        {
+            if (!m_is_ip_filter_changed.exchange(false))
+                return;
+
+            std::scoped_lock lock(m_ip_filter_mutex);
+            m_banned_ips.apply_changes();
+            m_allowed_ips.apply_changes();
+        }
+
+        // Connections that don't use ip like the loopback and shared memory connections are not filtered
+        [[nodiscard]] bool is_address_allowed(const asio::ip::address& address) const
+        {
+            if (address.is_unspecified())
+                return true;
+
+            if (!m_allowed_ips.empty() && !m_allowed_ips.contains(address))
+                return false;
+
+            return !m_banned_ips.contains(address);
         }
 
         /**
-         *   Removes the client from m_client
+         *   Removes the client from m_clients. This moves the last client to the place of the removed one.
          *
-         *   @param The iterator pointing to the client in m_clients
-         *   @return The iterator pointing to the next element after removed client
+         *   @param The id of the client in m_clients
          */
-        template <typename Client_it_type>
-        auto remove_client(Client_it_type client_it)
+        void remove_client(uint32_t id)
         {
-            const auto& connection = client_it->second.m_connection;
+            Client_data& client = *m_clients.find(id);
+            const std::string ip = client.m_connection->get_ip().data();
+            const asio::ip::address address = client.m_connection->get_address();
 
-            const uint32_t id = connection->get_id();
-            const std::string ip = connection->get_ip().data();
+            remove_from_topics(id, client.m_topics);
+            remove_from_interest_grid(id);
 
-            auto next_it = m_clients.erase(client_it);
+            // The Asio thread might still be using the connection
+            this->destroy_in_asio_thread(std::move(client.m_connection));
+            m_clients.erase(id);
 
-            this->notifications_push_back(std::format("Client disconnected ip: {} id: {}", ip, id));
+            this->notifications_push_back(
+                {.m_code = Notification_code::client_disconnected, .m_client_id = id, .m_address = address});
 
             m_on_client_disconnect.broadcast(Client_information(id, ip));
+        }
+
+        // Keeps the session of the client that lost the connection if the sessions are enabled
+        void drop_client(uint32_t id)
+        {
+            if (m_clients.find(id)->m_session != nullptr)
+                detach_client(id);
+            else
+                remove_client(id);
+        }
+
+        /**
+         *   Removes the client from m_clients and keeps its session until the client reconnects or it expires.
+         *   The id stays reserved for the session.
+         *
+         *   @param The id of the client in m_clients
+         */
+        void detach_client(uint32_t id)
+        {
+            Client_data& client = *m_clients.find(id);
+            const std::string ip = client.m_connection->get_ip().data();
+            const asio::ip::address address = client.m_connection->get_address();
+
+            Detached_session session = {
+                .m_session = std::move(client.m_session),
+                .m_session_token = client.m_session_token,
+                .m_ip = ip,
+                .m_address = address,
+                .m_expiry_time = std::chrono::steady_clock::now() + m_session_resume_window.value_or(Seconds(0)),
+                .m_topics = std::move(client.m_topics)};
+            m_detached_sessions.insert_or_assign(id, std::move(session));
+
+            // The position is not known until the client has reconnected
+            remove_from_interest_grid(id);
+
+            // The Asio thread might still be using the connection. It moves its unsent messages to the session.
+            this->destroy_in_asio_thread(std::move(client.m_connection));
+            m_clients.vacate(id);
+
+            this->notifications_push_back(
+                {.m_code = Notification_code::client_lost_connection, .m_client_id = id, .m_address = address});
+        }
+
+        // Removes the session of the client that did not reconnect
+        auto end_session(typename std::unordered_map<uint32_t, Detached_session>::iterator session_it)
+        {
+            const Client_information information(session_it->first, session_it->second.m_ip);
+            const asio::ip::address address = session_it->second.m_address;
+            remove_from_topics(information.m_id, session_it->second.m_topics);
+            auto next_it = m_detached_sessions.erase(session_it);
+            m_clients.release(information.m_id);
+
+            this->notifications_push_back(
+                {.m_code = Notification_code::client_disconnected,
+                 .m_client_id = information.m_id,
+                 .m_address = address});
+
+            m_on_client_disconnect.broadcast(information);
 
             return next_it;
         }
@@ -290,25 +1153,45 @@ namespace Net
         // Removes all the unconnected clients
         void check_connections() override
         {
-            auto clients_iterator = m_clients.begin();
-            while (clients_iterator != m_clients.end())
+            // Dropping moves the last client to the current index
+            size_t index = 0;
+            while (index < m_clients.size())
             {
-                const auto& connection = clients_iterator->second.m_connection;
-
-                if (!connection->is_connected())
-                    clients_iterator = remove_client(clients_iterator);
+                if (!m_clients.value_at(index).m_connection->is_connected())
+                    drop_client(m_clients.handle_at(index));
                 else
-                    ++clients_iterator;
+                    ++index;
             }
         }
 
-        std::unordered_map<uint32_t, Client_data> m_clients;
-        Thread_safe_deque<Protocol::socket> m_new_connections;
+        // Clients are in one array and their ids are the handles so finding them needs no hashing
+        Slot_map<Client_data> m_clients;
+        Thread_safe_deque<std::unique_ptr<Socket_interface>> m_new_connections;
 
-        Protocol::acceptor m_acceptor;
-        uint32_t m_id_counter = 1000;
+        // Responses from the other threads wait here for the update
+        Thread_safe_deque<Queued_response> m_queued_responses;
+        std::atomic<std::thread::id> m_update_thread_id;
+
+        std::vector<std::unique_ptr<Acceptor_interface>> m_acceptors;
 
         size_t m_max_connections = std::numeric_limits<size_t>::max();
-        std::unordered_set<std::string> m_banned_ip;
+        // Checked from the Asio thread when the connections are accepted. The mutex is only for changing them.
+        Ip_range_table m_banned_ips;
+        Ip_range_table m_allowed_ips;
+        std::mutex m_ip_filter_mutex;
+        std::atomic<bool> m_is_ip_filter_changed = false;
+
+        std::optional<Seconds> m_session_resume_window;
+        std::unordered_map<uint32_t, Detached_session> m_detached_sessions;
+
+        // Subscribers of the topics. Removing swaps with the last subscriber so they stay dense.
+        std::unordered_map<uint64_t, std::vector<uint32_t>> m_topics;
+
+        std::optional<Interest_grid> m_interest_grid;
+        std::random_device m_token_source;
+
+        // Clients whose handler has not finished and their messages waiting for it
+        Async_message_handler m_async_message_handler;
+        std::unordered_map<uint32_t, std::deque<Owned_message<Id_type>>> m_suspended_clients;
     };
 } // namespace Net
@@ -22,7 +22,8 @@ namespace Net
     private:
         [[nodiscard]] std::unique_ptr<Socket_interface> create_socket_interface(Protocol::socket socket) override
         {
-            return std::make_unique<Template_socket<Ssl_socket>>(Ssl_socket(std::move(socket), m_ssl_context));
+            using Ssl_template_socket = Template_socket<Ssl_socket, Connection<Id_type>>;
+            return std::make_unique<Ssl_template_socket>(Ssl_socket(std::move(socket), m_ssl_context));
         }
 
         asio::ssl::context m_ssl_context;
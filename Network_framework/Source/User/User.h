@@ -5,15 +5,55 @@
 #include "../Message/Owned_message.h"
 #include "../Sockets/Socket.h"
 #include "../Events/Delegate.h"
+#include "../Utility/Lock_free_ring.h"
+#include "../Utility/Notification.h"
 #include "../Utility/Thread_safe_deque.h"
+#include "../Utility/Worker_pool.h"
 #include "Asio_base.h"
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <concepts>
 #include <optional>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace Net
 {
+    // Which thread calls the message callbacks
+    enum class Message_dispatch : uint8_t
+    {
+        // Messages are queued and the callbacks are called from the update
+        queued,
+
+        // Callbacks are called straight from the Asio thread when the message is received
+        direct,
+
+        // Callbacks are called from the worker threads. Messages of one client are handled in order by one worker.
+        workers
+    };
+
+    // Counters of the user and its connections when the snapshot was taken
+    template <Id_concept Id_type>
+    struct Metrics_snapshot
+    {
+        // How many times the event has happened. These are counted even if the notification is filtered out.
+        [[nodiscard]] uint64_t get_event_count(Notification_code code) const noexcept
+        {
+            return m_event_counts[static_cast<size_t>(code)];
+        }
+
+        std::vector<Connection_metrics_snapshot<Id_type>> m_connections;
+
+        // Received messages of all the connections that have not been handled yet
+        Traffic m_in_queue;
+
+        // Indexed by the notification code
+        std::array<uint64_t, NOTIFICATION_CODE_COUNT> m_event_counts = {};
+    };
+
     // Base class for the server and the client
     template <Id_concept Id_type>
     class User : public Asio_base
@@ -26,6 +66,7 @@ namespace Net
         User()
         {
             m_accepted_messages = std::make_shared<Accepted_messages_container>();
+            m_inbound_budget = std::make_shared<Inbound_budget>();
         }
 
         virtual ~User() = default;
@@ -50,6 +91,94 @@ namespace Net
             m_accepted_messages->emplace(type, limits);
         }
 
+        /**
+         *   Limits how much received messages can wait for the update to handle them.
+         *   When exceeded the connections stop reading until update has handled enough messages.
+         *   Should be set before the connections are created.
+         *
+         *   @param the limits shared by all the connections
+         *   @param the limits for each connection
+         */
+        void set_inbound_limits(Inbound_limits shared_limits, Inbound_limits connection_limits = {}) noexcept
+        {
+            m_inbound_budget->set_limits(shared_limits);
+            m_connection_inbound_limits = connection_limits;
+        }
+
+        /**
+         *   Sets timeouts for the connections that are checked in the Asio thread.
+         *   Should be set before the connections are created.
+         */
+        void set_connection_timeouts(Connection_timeouts timeouts) noexcept
+        {
+            m_connection_timeouts = timeouts;
+        }
+
+        /**
+         *   Sets the options that are applied to the socket of every new connection.
+         *   Should be set before the connections are created.
+         */
+        void set_socket_options(Socket_options options) noexcept
+        {
+            m_socket_options = std::move(options);
+        }
+
+        /**
+         *   Sets how often the connections ping the remote to measure the latency. Zero disables pinging.
+         *   Should be set before the connections are created.
+         */
+        void set_ping_interval(Timer_wheel::Duration ping_interval) noexcept
+        {
+            m_ping_interval = ping_interval;
+        }
+
+        /**
+         *   Sets how the connections read and write the messages.
+         *   Should be set before the connections are created.
+         */
+        void set_connection_pipeline(Connection_pipeline pipeline) noexcept
+        {
+            m_connection_pipeline = pipeline;
+        }
+
+        /**
+         *   Sets which thread calls the message callback. Should be set before the connections are created.
+         *
+         *   With the direct dispatch the callback is called from the Asio thread while the update can be running
+         *   in other thread at the same time. The callback should not block since it stops all the connections,
+         *   and anything it shares with the rest of the program has to be synchronized. It should not call
+         *   update or any method that changes the connections, like disconnecting. The messages internal to the
+         *   framework are still handled in the update.
+         *
+         *   With the workers the same rules apply except that the callback can block its own worker.
+         *   The callbacks of different clients run at the same time.
+         *
+         *   @param the dispatch
+         *   @param how many workers there are. Zero means one for each hardware thread.
+         *   @throws if the asynchronous handlers are used and the dispatch is not queued
+         */
+        void set_message_dispatch(Message_dispatch dispatch, size_t worker_count = 0)
+        {
+            if (m_handler_context != nullptr && dispatch != Message_dispatch::queued)
+                throw std::logic_error("Asynchronous handlers only work with the queued message dispatch");
+
+            m_message_dispatch = dispatch;
+            m_message_workers.reset();
+
+            if (dispatch == Message_dispatch::workers)
+                m_message_workers = std::make_unique<Worker_pool<Queued_message>>(
+                    worker_count, [this](Queued_message message) { handle_queued_message(std::move(message)); });
+        }
+
+        // How many messages each worker has waiting or handling. Empty if workers are not used.
+        [[nodiscard]] std::vector<size_t> get_worker_queue_depths() const
+        {
+            if (m_message_workers == nullptr)
+                return {};
+
+            return m_message_workers->get_queue_depths();
+        }
+
         /**
          *   Handle everything received through internet
          *
@@ -66,14 +195,18 @@ namespace Net
             else if (wait)
                 wait_until_has_something_to_do();
 
-            for (size_t i = 0; i < max_handled_items && !m_notifications.empty(); ++i)
-            {
-                const Notification notification = m_notifications.pop_front();
-                m_on_notification.broadcast(notification.m_message, notification.m_severity);
-            }
+            handle_notifications(max_handled_items);
         }
 
+        // Notifications below this severity are dropped before doing anything with them
+        void set_notification_severity(Severity minimum_severity) noexcept
+        {
+            m_notification_severity.store(minimum_severity, std::memory_order_relaxed);
+        }
+
+        // The notification is formatted to text only for this callback
         Delegate<std::string_view, Severity> m_on_notification;
+        Delegate<const Notification&> m_on_notification_event;
 
     protected:
         bool is_in_queue_empty()
@@ -88,32 +221,105 @@ namespace Net
          */
         [[nodiscard]] Owned_message<Id_type> in_queue_pop_front()
         {
-            return m_in_queue.pop_back();
+            Queued_message queued_message = m_in_queue.pop_front();
+            release_budgets(*queued_message.m_connection_budget, message_size(queued_message.m_message));
+
+            return std::move(queued_message.m_message);
         }
 
-        void notify_wait() noexcept
+        // Handles the messages that are still in the workers. Should be called before the derived class is destroyed.
+        void stop_message_workers()
+        {
+            if (m_message_workers != nullptr)
+                m_message_workers->stop();
+        }
+
+        void notify_wait()
         {
             m_wait_condition.notify_one();
+
+            // Wakes up the update waiting in the handler context
+            if (m_handler_context != nullptr)
+                asio::post(*m_handler_context, [] {});
+        }
+
+        /**
+         *   Creates the context where the asynchronous handlers run. It is run by the thread calling update.
+         *   Should be called before the Asio thread is started.
+         *
+         *   @throws if the message dispatch is not queued since the handlers would run in other threads
+         */
+        void enable_handler_context()
+        {
+            if (m_message_dispatch != Message_dispatch::queued)
+                throw std::logic_error("Asynchronous handlers only work with the queued message dispatch");
+
+            if (m_handler_context != nullptr)
+                return;
+
+            m_handler_context = std::make_unique<asio::io_context>(1);
+            m_handler_work.emplace(m_handler_context->get_executor());
+        }
+
+        // Nullptr if the handler context is not enabled
+        [[nodiscard]] asio::io_context* get_handler_context() noexcept
+        {
+            return m_handler_context.get();
+        }
+
+        // Runs the handlers in the handler context that are ready
+        void poll_handler_context()
+        {
+            if (m_handler_context != nullptr)
+                m_handler_context->poll();
         }
 
         // Thread safe push back to queue
-        void in_queue_push_back(Owned_message<Id_type> message)
+        void in_queue_push_back(Owned_message<Id_type> message, std::shared_ptr<Inbound_budget> connection_budget)
         {
-            m_in_queue.push_back(std::move(message));
+            m_in_queue.push_back({std::move(message), std::move(connection_budget)});
             notify_wait();
         }
 
-        // Thread safe push back to queue
-        void notifications_push_back(std::string message, Severity severity = Severity::notification)
+        // Thread safe and doesn't lock so the Asio thread never waits for the user thread
+        void notifications_push_back(const Notification& notification)
         {
-            if (!m_on_notification.has_been_set())
+            m_event_counts[static_cast<size_t>(notification.m_code)].fetch_add(1, std::memory_order_relaxed);
+
+            if (notification.m_severity < m_notification_severity.load(std::memory_order_relaxed))
+                return;
+
+            if (!m_on_notification.has_been_set() && !m_on_notification_event.has_been_set())
+                return;
+
+            if (!m_notifications.try_push(notification))
+            {
+                m_dropped_notification_count.fetch_add(1, std::memory_order_relaxed);
+                m_event_counts[static_cast<size_t>(Notification_code::notifications_dropped)].fetch_add(
+                    1, std::memory_order_relaxed);
                 return;
+            }
 
-            Notification notification = {.m_message = message, .m_severity = severity};
-            m_notifications.push_back(std::move(notification));
             notify_wait();
         }
 
+        void notifications_push_back(Notification_code code, Severity severity = Severity::notification)
+        {
+            notifications_push_back({.m_code = code, .m_severity = severity});
+        }
+
+        // Snapshot without the connections. Doesn't stop the Asio thread.
+        [[nodiscard]] Metrics_snapshot<Id_type> create_metrics_snapshot() const
+        {
+            Metrics_snapshot<Id_type> snapshot;
+            snapshot.m_in_queue = {m_inbound_budget->get_messages(), m_inbound_budget->get_bytes()};
+
+            for (size_t i = 0; i < NOTIFICATION_CODE_COUNT; ++i)
+                snapshot.m_event_counts[i] = m_event_counts[i].load(std::memory_order_relaxed);
+
+            return snapshot;
+        }
+
         [[nodiscard]] virtual bool should_stop_waiting()
         {
             const bool has_messages = !m_in_queue.empty();
@@ -122,10 +328,45 @@ namespace Net
             return has_messages || has_notifications;
         }
 
+        // Calls the message callback for the message that is not internal
+        virtual void handle_message(Owned_message<Id_type> message) = 0;
+
+        // Called from the Asio thread for the responses. Returns true if the response was handled.
+        virtual bool handle_response([[maybe_unused]] Message<Id_type>& response)
+        {
+            return false;
+        }
+
         // Event when received new message from the connection
-        void on_message_received(Owned_message<Id_type> message)
+        void on_message_received(Owned_message<Id_type> message, std::shared_ptr<Inbound_budget> connection_budget)
         {
-            in_queue_push_back(std::move(message));
+            // Responses skip the update so the requesters don't wait for it
+            if (message.m_message.get_rpc_type() == Rpc_type::response)
+            {
+                const size_t size = message_size(message);
+
+                if (handle_response(message.m_message))
+                {
+                    release_budgets(*connection_budget, size);
+                    return;
+                }
+            }
+
+            if (m_message_dispatch == Message_dispatch::queued ||
+                message.m_message.get_internal_id() != Internal_id::not_internal)
+            {
+                in_queue_push_back(std::move(message), std::move(connection_budget));
+                return;
+            }
+
+            if (m_message_dispatch == Message_dispatch::workers)
+            {
+                const uint32_t client_id = message.get_client_id();
+                m_message_workers->post(client_id, {std::move(message), std::move(connection_budget)});
+                return;
+            }
+
+            handle_queued_message({std::move(message), std::move(connection_budget)});
         }
 
         /**
@@ -134,48 +375,140 @@ namespace Net
          *   @param socket to use
          *   @param if for rhe connection
          *   @param should we use client or server type of handshake
+         *   @param the session that the connection continues or nullptr if messages are not replayed
          *   @return unique_ptr to the connection object
          */
         [[nodiscard]] std::unique_ptr<Connection<Id_type>> create_connection(
-            std::unique_ptr<Socket_interface> socket, uint32_t connection_id, Handshake_type handshake_type)
+            std::unique_ptr<Socket_interface> socket, uint32_t connection_id, Handshake_type handshake_type,
+            std::shared_ptr<Session_state<Id_type>> session = nullptr)
         {
             std::unique_ptr new_connection = std::make_unique<Connection<Id_type>>(std::move(socket), connection_id);
 
             // Setups the callbacks
-            new_connection->m_on_message.set_callback(this, &User<Id_type>::on_message_received);
-            new_connection->m_on_notification.set_callback(this, &User<Id_type>::notifications_push_back);
+            new_connection->m_on_message.set_callback(
+                [this, budget = new_connection->get_inbound_budget()](Owned_message<Id_type> message) {
+                    on_message_received(std::move(message), budget);
+                });
+            new_connection->m_on_notification.set_callback(
+                [this](const Notification& notification) { notifications_push_back(notification); });
 
             // Gives shared pointer of the accepted messages to the connection
             new_connection->set_accepted_messages(m_accepted_messages);
 
+            new_connection->set_inbound_limits(m_connection_inbound_limits);
+            new_connection->set_shared_inbound_budget(m_inbound_budget);
+            new_connection->set_timer_wheel(&this->get_timer_wheel(), m_connection_timeouts);
+            new_connection->set_ping_interval(m_ping_interval);
+            new_connection->set_pipeline(m_connection_pipeline);
+            new_connection->set_session(std::move(session));
+
             new_connection->start(handshake_type);
 
             return new_connection;
         }
 
+        template <typename Asio_socket>
         [[nodiscard]] std::unique_ptr<Connection<Id_type>> create_connection(
-            Protocol::socket socket, uint32_t connection_id, Handshake_type handshake_type)
+            Asio_socket socket, uint32_t connection_id, Handshake_type handshake_type,
+            std::shared_ptr<Session_state<Id_type>> session = nullptr)
+        {
+            return create_connection(
+                make_socket_interface(std::move(socket)), connection_id, handshake_type, std::move(session));
+        }
+
+        /**
+         *   Applies the socket options and wraps the socket in the socket interface.
+         *   Tcp sockets are created with create_socket_interface so they can use ssl.
+         */
+        template <typename Asio_socket>
+        [[nodiscard]] std::unique_ptr<Socket_interface> make_socket_interface(Asio_socket socket)
         {
-            std::unique_ptr<Socket_interface> socket_interface = create_socket_interface(std::move(socket));
-            return create_connection(std::move(socket_interface), connection_id, handshake_type);
+            if (const asio::error_code error = apply_socket_options(socket, m_socket_options))
+                notifications_push_back(
+                    {.m_code = Notification_code::socket_options_failed,
+                     .m_severity = Severity::error,
+                     .m_error = error});
+
+            if constexpr (std::is_same_v<Asio_socket, Protocol::socket>)
+                return create_socket_interface(std::move(socket));
+            else
+                return std::make_unique<Template_socket<Asio_socket, Connection<Id_type>>>(std::move(socket));
         }
 
     private:
-        struct Notification
+        // How many notifications can wait for the update before the new ones are dropped
+        static constexpr size_t NOTIFICATION_CAPACITY = 1024;
+
+        // Received message and the budget of the connection it came from
+        struct Queued_message
         {
-            std::string m_message = "";
-            Severity m_severity = Severity::notification;
+            Owned_message<Id_type> m_message;
+            std::shared_ptr<Inbound_budget> m_connection_budget;
         };
 
+        [[nodiscard]] static size_t message_size(const Owned_message<Id_type>& message) noexcept
+        {
+            return message.m_message.header_size() + message.m_message.body_size();
+        }
+
+        // Allows the connections to continue reading if they were paused
+        void release_budgets(Inbound_budget& connection_budget, size_t message_size)
+        {
+            connection_budget.release(message_size);
+            m_inbound_budget->release(message_size);
+        }
+
+        // Handles the message outside of the update and releases the budgets after it
+        void handle_queued_message(Queued_message queued_message)
+        {
+            const size_t size = message_size(queued_message.m_message);
+            handle_message(std::move(queued_message.m_message));
+            release_budgets(*queued_message.m_connection_budget, size);
+        }
+
+        void handle_notifications(size_t max_handled_items)
+        {
+            if (const uint64_t dropped_count = m_dropped_notification_count.exchange(0, std::memory_order_relaxed))
+            {
+                broadcast_notification(
+                    {.m_code = Notification_code::notifications_dropped,
+                     .m_severity = Severity::error,
+                     .m_value = dropped_count});
+            }
+
+            for (size_t i = 0; i < max_handled_items; ++i)
+            {
+                const std::optional<Notification> notification = m_notifications.try_pop();
+                if (!notification.has_value())
+                    break;
+
+                broadcast_notification(notification.value());
+            }
+        }
+
+        void broadcast_notification(const Notification& notification)
+        {
+            m_on_notification_event.broadcast(notification);
+
+            if (m_on_notification.has_been_set())
+                m_on_notification.broadcast(notification.to_string(), notification.m_severity);
+        }
+
         // Creates spesific socket interface for connection
         [[nodiscard]] virtual std::unique_ptr<Socket_interface> create_socket_interface(Protocol::socket socket)
         {
-            return std::make_unique<Template_socket<Protocol::socket>>(std::move(socket));
+            return std::make_unique<Template_socket<Protocol::socket, Connection<Id_type>>>(std::move(socket));
         }
 
         // You can spesify the max waiting time otherwise this will wait until something notifies it
         void wait_until_has_something_to_do(std::optional<Seconds> wait_time = std::optional<Seconds>())
         {
+            if (m_handler_context != nullptr)
+            {
+                wait_in_handler_context(wait_time);
+                return;
+            }
+
             std::unique_lock lock(m_wait_mutex);
 
             auto wait_lambda = [this] { return should_stop_waiting(); };
@@ -186,6 +519,21 @@ namespace Net
                 m_wait_condition.wait(lock, wait_lambda);
         }
 
+        // Runs the handler context while waiting so the suspended handlers can continue. Stops after any handler ran.
+        void wait_in_handler_context(std::optional<Seconds> wait_time)
+        {
+            const auto deadline = std::chrono::steady_clock::now() + wait_time.value_or(Seconds(0));
+
+            while (!should_stop_waiting())
+            {
+                const size_t handled = wait_time.has_value() ? m_handler_context->run_one_until(deadline)
+                                                             : m_handler_context->run_one();
+
+                if (handled > 0 || (wait_time.has_value() && std::chrono::steady_clock::now() >= deadline))
+                    return;
+            }
+        }
+
         /**
          * Checks if enough time has passed for checking all connections
          * Otherwise will wait if needed.
@@ -223,15 +571,36 @@ namespace Net
 
         std::condition_variable m_wait_condition;
         std::mutex m_wait_mutex;
+
+        // Context for the asynchronous handlers and the work that keeps it running while it has nothing to do
+        std::unique_ptr<asio::io_context> m_handler_context;
+        std::optional<asio::executor_work_guard<asio::io_context::executor_type>> m_handler_work;
+
         std::chrono::steady_clock::time_point m_last_connection_check;
 
         // Accepted message types
         std::shared_ptr<Accepted_messages_container> m_accepted_messages;
 
         // Received messages from the conenctions
-        Thread_safe_deque<Owned_message<Id_type>> m_in_queue;
-
-        // the notification to be handled
-        Thread_safe_deque<Notification> m_notifications;
+        Thread_safe_deque<Queued_message> m_in_queue;
+
+        // Limits for the received messages waiting in the m_in_queue
+        std::shared_ptr<Inbound_budget> m_inbound_budget;
+        Inbound_limits m_connection_inbound_limits;
+
+        Connection_timeouts m_connection_timeouts;
+        Timer_wheel::Duration m_ping_interval = {};
+        Connection_pipeline m_connection_pipeline = Connection_pipeline::callbacks;
+        Message_dispatch m_message_dispatch = Message_dispatch::queued;
+        std::unique_ptr<Worker_pool<Queued_message>> m_message_workers;
+        Socket_options m_socket_options;
+
+        // The notifications to be handled. When it is full the new notifications are counted and dropped.
+        Lock_free_ring<Notification> m_notifications{NOTIFICATION_CAPACITY};
+        std::atomic<uint64_t> m_dropped_notification_count = 0;
+        std::atomic<Severity> m_notification_severity = Severity::notification;
+
+        // Counted before the notifications are filtered
+        std::array<std::atomic<uint64_t>, NOTIFICATION_CODE_COUNT> m_event_counts = {};
     };
 }; // namespace Net
@@ -1,11 +1,28 @@
 #pragma once
 
+#include <chrono>
 #include <compare>
 #include <cstdint>
+#include <string>
 #include <string_view>
 
 namespace Net
 {
+    // Latency measured with the framework pings. Everything is zero until the first pong is received.
+    struct Latency_information
+    {
+        auto operator<=>(const Latency_information&) const = default;
+
+        // Smoothed round trip time
+        std::chrono::nanoseconds m_round_trip_time = {};
+
+        // Smoothed variation of the round trip time
+        std::chrono::nanoseconds m_jitter = {};
+
+        // Remote clock minus the local clock
+        std::chrono::nanoseconds m_clock_offset = {};
+    };
+
     struct Client_information
     {
         Client_information() = default;
@@ -17,5 +34,6 @@ namespace Net
 
         uint32_t m_id = 0;
         std::string m_ip = "0.0.0.0";
+        Latency_information m_latency;
     };
 } // namespace Net
@@ -10,6 +10,17 @@
 #define _WIN32_WINNT 0x0A00
 #endif
 
+/**
+ *   Experimental. Define NET_USE_IO_URING to make Asio use io_uring instead of epoll on Linux.
+ *   Asio picks the backend for the whole program at compile time and it needs liburing to be linked.
+ *   There is no fallback to epoll. On kernels without io_uring, or where it is disabled, Asio throws when the first
+ *   socket or timer needs the backend and nothing can connect. Only define it where io_uring is known to work.
+ */
+#if defined(NET_USE_IO_URING) && defined(__linux__)
+#define ASIO_HAS_IO_URING
+#define ASIO_DISABLE_EPOLL
+#endif
+
 #include "asio.hpp"
 #include "asio/buffer.hpp"
 #include "asio/socket_base.hpp"
@@ -23,7 +34,25 @@ namespace Net
     // The Asio types that we currently use in this framework
     using Protocol = asio::ip::tcp;
     using Ssl_socket = asio::ssl::stream<Protocol::socket>;
- 
+
+    // Unix domain sockets for the connections in the same machine
+    using Local_protocol = asio::local::stream_protocol;
+
+    // Backend that Asio uses for the sockets
+    enum class Io_backend : uint8_t
+    {
+        io_uring,
+        epoll,
+        other
+    };
+
+#if defined(ASIO_HAS_IO_URING_AS_DEFAULT)
+    static constexpr Io_backend IO_BACKEND = Io_backend::io_uring;
+#elif defined(ASIO_HAS_EPOLL)
+    static constexpr Io_backend IO_BACKEND = Io_backend::epoll;
+#else
+    static constexpr Io_backend IO_BACKEND = Io_backend::other;
+#endif
 
     // Notification severities
     enum class Severity : uint8_t
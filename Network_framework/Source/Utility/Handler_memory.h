@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Common.h"
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <new>
+
+namespace Net
+{
+    /**
+     *   Memory for the state of one Asio operation at a time so the steady state reads and writes don't allocate.
+     *   Falls back to the heap if the memory is in use or too small.
+     */
+    class Handler_memory
+    {
+    public:
+        static constexpr size_t SIZE = 512;
+
+        Handler_memory() noexcept = default;
+
+        Handler_memory(const Handler_memory&) = delete;
+        Handler_memory(Handler_memory&&) = delete;
+
+        ~Handler_memory() = default;
+
+        Handler_memory& operator=(const Handler_memory&) = delete;
+        Handler_memory& operator=(Handler_memory&&) = delete;
+
+        [[nodiscard]] void* allocate(size_t size)
+        {
+            if (!m_is_in_use && size <= m_storage.size())
+            {
+                m_is_in_use = true;
+                return m_storage.data();
+            }
+
+            return ::operator new(size);
+        }
+
+        void deallocate(void* pointer) noexcept
+        {
+            if (pointer == m_storage.data())
+                m_is_in_use = false;
+            else
+                ::operator delete(pointer);
+        }
+
+    private:
+        alignas(std::max_align_t) std::array<std::byte, SIZE> m_storage = {};
+        bool m_is_in_use = false;
+    };
+
+    /**
+     *   Allocator that Asio uses for the handler state when it is bound to the handler with asio::bind_allocator.
+     *   Keeps the memory alive since pending operations can be destroyed after the owner of the memory.
+     */
+    template <typename Type>
+    class Handler_allocator
+    {
+    public:
+        using value_type = Type;
+
+        explicit Handler_allocator(std::shared_ptr<Handler_memory> memory) noexcept : m_memory(std::move(memory))
+        {
+        }
+
+        template <typename Other_type>
+        Handler_allocator(const Handler_allocator<Other_type>& other) noexcept : m_memory(other.m_memory)
+        {
+        }
+
+        [[nodiscard]] Type* allocate(size_t count)
+        {
+            return static_cast<Type*>(m_memory->allocate(sizeof(Type) * count));
+        }
+
+        void deallocate(Type* pointer, [[maybe_unused]] size_t count) noexcept
+        {
+            m_memory->deallocate(pointer);
+        }
+
+        template <typename Other_type>
+        [[nodiscard]] bool operator==(const Handler_allocator<Other_type>& other) const noexcept
+        {
+            return m_memory == other.m_memory;
+        }
+
+    private:
+        template <typename Other_type>
+        friend class Handler_allocator;
+
+        std::shared_ptr<Handler_memory> m_memory;
+    };
+} // namespace Net
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "../Events/Delegate.h"
+#include <cmath>
+#include <compare>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace Net
+{
+    struct Position
+    {
+        float m_x = 0.0f;
+        float m_y = 0.0f;
+    };
+
+    // Cell of the interest grid
+    struct Grid_cell
+    {
+        auto operator<=>(const Grid_cell&) const = default;
+
+        int32_t m_x = 0;
+        int32_t m_y = 0;
+    };
+
+    /**
+     *   Uniform grid of entity positions for finding the entities near a position without going through all of them.
+     *   Moving an entity only touches its old and new cell. Not thread safe.
+     */
+    class Interest_grid
+    {
+    public:
+        /**
+         *   @param width of a cell. Queries are fastest when the usual radius is about the cell size.
+         *   @throws if the cell size is not positive
+         */
+        explicit Interest_grid(float cell_size) : m_cell_size(cell_size)
+        {
+            if (!(cell_size > 0.0f))
+                throw std::invalid_argument("Interest grid cell size must be positive");
+        }
+
+        /**
+         *   Adds the entity or moves it if it is already in the grid
+         *
+         *   @throws if the position is not finite
+         */
+        void set_position(uint32_t id, Position position)
+        {
+            if (!is_finite(position))
+                throw std::invalid_argument("Interest grid position must be finite");
+
+            const Grid_cell cell = get_cell(position);
+
+            auto [found_entity, is_added] = m_entities.try_emplace(id);
+            Entity& entity = found_entity->second;
+            entity.m_position = position;
+
+            if (is_added)
+            {
+                add_to_cell(id, entity, cell);
+                m_on_enter.broadcast(id, cell);
+            }
+            else if (entity.m_cell != cell)
+            {
+                const Grid_cell old_cell = entity.m_cell;
+                remove_from_cell(entity);
+                add_to_cell(id, entity, cell);
+
+                m_on_leave.broadcast(id, old_cell);
+                m_on_enter.broadcast(id, cell);
+            }
+        }
+
+        void remove(uint32_t id)
+        {
+            auto found_entity = m_entities.find(id);
+            if (found_entity == m_entities.end())
+                return;
+
+            const Grid_cell cell = found_entity->second.m_cell;
+            remove_from_cell(found_entity->second);
+            m_entities.erase(found_entity);
+
+            m_on_leave.broadcast(id, cell);
+        }
+
+        /**
+         *   Calls the function with the id of every entity that is within the radius.
+         *   If the radius covers more cells than there are occupied ones only the occupied cells are checked.
+         *
+         *   @param the center
+         *   @param the radius
+         *   @param function that takes the id
+         *   @throws if the position or the radius is not finite or the radius is negative
+         */
+        template <typename Function_type>
+        void for_each_near(Position position, float radius, Function_type&& function) const
+        {
+            if (!is_finite(position) || !std::isfinite(radius) || radius < 0.0f)
+                throw std::invalid_argument("Interest grid query must have finite position and radius");
+
+            const Grid_cell min_cell = get_cell({position.m_x - radius, position.m_y - radius});
+            const Grid_cell max_cell = get_cell({position.m_x + radius, position.m_y + radius});
+            const float radius_squared = radius * radius;
+
+            auto check_cell = [&](const std::vector<uint32_t>& ids) {
+                for (const uint32_t id : ids)
+                {
+                    const Position& other = m_entities.find(id)->second.m_position;
+                    const float delta_x = other.m_x - position.m_x;
+                    const float delta_y = other.m_y - position.m_y;
+
+                    if (delta_x * delta_x + delta_y * delta_y <= radius_squared)
+                        function(id);
+                }
+            };
+
+            // 64 bits since the cells can span the whole range of int32
+            const int64_t width = static_cast<int64_t>(max_cell.m_x) - min_cell.m_x + 1;
+            const int64_t height = static_cast<int64_t>(max_cell.m_y) - min_cell.m_y + 1;
+
+            // Same as width * height > m_cells.size() without overflowing
+            if (static_cast<uint64_t>(width) > m_cells.size() / static_cast<uint64_t>(height))
+            {
+                for (const auto& [key, ids] : m_cells)
+                {
+                    const Grid_cell cell = get_cell_of_key(key);
+
+                    if (cell.m_x >= min_cell.m_x && cell.m_x <= max_cell.m_x && cell.m_y >= min_cell.m_y &&
+                        cell.m_y <= max_cell.m_y)
+                        check_cell(ids);
+                }
+
+                return;
+            }
+
+            for (int64_t x = min_cell.m_x; x <= max_cell.m_x; ++x)
+            {
+                for (int64_t y = min_cell.m_y; y <= max_cell.m_y; ++y)
+                {
+                    auto found_cell = m_cells.find(get_key({static_cast<int32_t>(x), static_cast<int32_t>(y)}));
+
+                    if (found_cell != m_cells.end())
+                        check_cell(found_cell->second);
+                }
+            }
+        }
+
+        // Returns nullptr if the entity is not in the grid
+        [[nodiscard]] const Position* get_position(uint32_t id) const
+        {
+            auto found_entity = m_entities.find(id);
+            return found_entity != m_entities.end() ? &found_entity->second.m_position : nullptr;
+        }
+
+        // Positions beyond the range of the cells are in the outermost cells
+        [[nodiscard]] Grid_cell get_cell(Position position) const noexcept
+        {
+            return {get_cell_coordinate(position.m_x), get_cell_coordinate(position.m_y)};
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_entities.size();
+        }
+
+        // Broadcast when the entity is added or moves to the cell
+        Delegate<uint32_t, Grid_cell> m_on_enter;
+
+        // Broadcast when the entity is removed or moves out of the cell
+        Delegate<uint32_t, Grid_cell> m_on_leave;
+
+    private:
+        struct Entity
+        {
+            Position m_position;
+            Grid_cell m_cell;
+
+            // Index in the ids of the cell
+            size_t m_index = 0;
+        };
+
+        static uint64_t get_key(Grid_cell cell) noexcept
+        {
+            return static_cast<uint64_t>(static_cast<uint32_t>(cell.m_x)) << 32 | static_cast<uint32_t>(cell.m_y);
+        }
+
+        static Grid_cell get_cell_of_key(uint64_t key) noexcept
+        {
+            return {static_cast<int32_t>(static_cast<uint32_t>(key >> 32)),
+                    static_cast<int32_t>(static_cast<uint32_t>(key))};
+        }
+
+        [[nodiscard]] static bool is_finite(Position position) noexcept
+        {
+            return std::isfinite(position.m_x) && std::isfinite(position.m_y);
+        }
+
+        // Clamped since casting the values that don't fit to int32 is undefined. NaN goes to the last cell.
+        [[nodiscard]] int32_t get_cell_coordinate(float coordinate) const noexcept
+        {
+            constexpr auto min_cell = static_cast<double>(std::numeric_limits<int32_t>::min());
+            constexpr auto max_cell = static_cast<double>(std::numeric_limits<int32_t>::max());
+
+            const double cell = std::floor(static_cast<double>(coordinate) / m_cell_size);
+            return static_cast<int32_t>(std::fmax(std::fmin(cell, max_cell), min_cell));
+        }
+
+        void add_to_cell(uint32_t id, Entity& entity, Grid_cell cell)
+        {
+            auto& ids = m_cells[get_key(cell)];
+
+            entity.m_cell = cell;
+            entity.m_index = ids.size();
+            ids.push_back(id);
+        }
+
+        // Swaps the entity with the last one in the cell so the ids stay dense
+        void remove_from_cell(const Entity& entity)
+        {
+            auto found_cell = m_cells.find(get_key(entity.m_cell));
+            auto& ids = found_cell->second;
+
+            const uint32_t moved_id = ids.back();
+            ids[entity.m_index] = moved_id;
+            m_entities.find(moved_id)->second.m_index = entity.m_index;
+            ids.pop_back();
+
+            if (ids.empty())
+                m_cells.erase(found_cell);
+        }
+
+        float m_cell_size;
+        std::unordered_map<uint32_t, Entity> m_entities;
+        std::unordered_map<uint64_t, std::vector<uint32_t>> m_cells;
+    };
+} // namespace Net
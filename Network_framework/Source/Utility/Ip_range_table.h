@@ -0,0 +1,209 @@
+#pragma once
+
+#include "Common.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <compare>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Address ranges for the ban and allow lists. Checking an address is a binary search without formatting it.
+     *   Ipv4 addresses are stored as ipv4 mapped ipv6 addresses so both can be in the same table.
+     *
+     *   Changes are checked after apply_changes publishes them as a new snapshot, so many networks can be changed
+     *   with one rebuild. Only one thread at a time can change the table and apply the changes but contains and
+     *   empty can be called from any thread at the same time. They don't lock or sort.
+     */
+    class Ip_range_table
+    {
+    public:
+        /**
+         *   Adds the addresses of the network
+         *
+         *   @param any address of the network
+         *   @param how many bits of the address are the network. Ipv4 uses 0-32 and ipv6 0-128.
+         *   @throws if the prefix length is too long for the address
+         */
+        void add(const asio::ip::address& network, uint8_t prefix_length)
+        {
+            m_networks.insert(to_range(network, prefix_length));
+            m_is_changed = true;
+        }
+
+        /**
+         *   Adds the address or the network written as "address/prefix length"
+         *
+         *   @throws if it is not valid address or network
+         */
+        void add(std::string_view network)
+        {
+            const auto [address, prefix_length] = parse(network);
+            add(address, prefix_length);
+        }
+
+        /**
+         *   Removes the network that was added with the same address and prefix length.
+         *   Network that was added many times stays until it has been removed as many times.
+         */
+        void remove(const asio::ip::address& network, uint8_t prefix_length)
+        {
+            auto found_network = m_networks.find(to_range(network, prefix_length));
+            if (found_network == m_networks.end())
+                return;
+
+            m_networks.erase(found_network);
+            m_is_changed = true;
+        }
+
+        // Removes the address or network that was added with the same string
+        void remove(std::string_view network)
+        {
+            const auto [address, prefix_length] = parse(network);
+            remove(address, prefix_length);
+        }
+
+        // Merges the overlapping networks and publishes them for the checks. The networks are already sorted.
+        void apply_changes()
+        {
+            if (!m_is_changed)
+                return;
+
+            auto ranges = std::make_shared<std::vector<Range>>();
+
+            for (const Range& range : m_networks)
+            {
+                if (!ranges->empty() && range.m_first <= ranges->back().m_last)
+                    ranges->back().m_last = std::max(ranges->back().m_last, range.m_last);
+                else
+                    ranges->push_back(range);
+            }
+
+            m_ranges.store(std::move(ranges), std::memory_order_release);
+            m_is_changed = false;
+        }
+
+        // Checks the networks that were there when the changes were applied the last time
+        [[nodiscard]] bool contains(const asio::ip::address& address) const
+        {
+            const std::shared_ptr<const std::vector<Range>> ranges = m_ranges.load(std::memory_order_acquire);
+            const Key key = to_key(address);
+
+            // The last range starting before or at the key
+            auto found_range =
+                std::upper_bound(ranges->begin(), ranges->end(), key, [](const Key& key, const Range& range) {
+                    return key < range.m_first;
+                });
+
+            return found_range != ranges->begin() && key <= std::prev(found_range)->m_last;
+        }
+
+        // True if there were no networks when the changes were applied the last time
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return m_ranges.load(std::memory_order_acquire)->empty();
+        }
+
+        // How many networks have been added. Includes the changes that have not been applied.
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_networks.size();
+        }
+
+        void clear() noexcept
+        {
+            m_networks.clear();
+            m_is_changed = true;
+        }
+
+    private:
+        // Ipv6 address as a 128 bit number
+        struct Key
+        {
+            auto operator<=>(const Key&) const = default;
+
+            uint64_t m_high = 0;
+            uint64_t m_low = 0;
+        };
+
+        // Ordered by the first address and then by the last one
+        struct Range
+        {
+            auto operator<=>(const Range&) const = default;
+
+            Key m_first;
+            Key m_last;
+        };
+
+        static Key to_key(const asio::ip::address& address) noexcept
+        {
+            if (address.is_v4())
+                return {0, 0x0000'FFFF'0000'0000ull | address.to_v4().to_uint()};
+
+            const asio::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+            Key key;
+
+            for (size_t i = 0; i < 8; ++i)
+            {
+                key.m_high = key.m_high << 8 | bytes[i];
+                key.m_low = key.m_low << 8 | bytes[i + 8];
+            }
+
+            return key;
+        }
+
+        static Range to_range(const asio::ip::address& network, uint8_t prefix_length)
+        {
+            const uint8_t max_prefix_length = network.is_v4() ? 32 : 128;
+            if (prefix_length > max_prefix_length)
+                throw std::invalid_argument("Prefix length is too long for the address");
+
+            // Ipv4 addresses are after the 96 bits of the ipv4 mapped prefix
+            const uint32_t host_bits = max_prefix_length - prefix_length;
+            const Key key = to_key(network);
+
+            const uint64_t high_mask = host_bits > 64 ? ~0ull >> (128 - host_bits) : 0;
+            const uint64_t low_mask = host_bits >= 64 ? ~0ull : (host_bits == 0 ? 0 : ~0ull >> (64 - host_bits));
+
+            return {{key.m_high & ~high_mask, key.m_low & ~low_mask}, {key.m_high | high_mask, key.m_low | low_mask}};
+        }
+
+        static std::pair<asio::ip::address, uint8_t> parse(std::string_view network)
+        {
+            const size_t separator = network.find('/');
+
+            asio::error_code error;
+            const asio::ip::address address = asio::ip::make_address(network.substr(0, separator), error);
+            if (error)
+                throw std::invalid_argument("Invalid ip address");
+
+            if (separator == std::string_view::npos)
+                return {address, address.is_v4() ? 32 : 128};
+
+            const std::string_view prefix = network.substr(separator + 1);
+            const char* prefix_end = prefix.data() + prefix.size();
+            unsigned prefix_length = 0;
+
+            const auto [end, parse_error] = std::from_chars(prefix.data(), prefix_end, prefix_length);
+            if (parse_error != std::errc() || end != prefix_end || prefix_length > 128)
+                throw std::invalid_argument("Invalid prefix length");
+
+            return {address, static_cast<uint8_t>(prefix_length)};
+        }
+
+        // The networks as they were added. Sorted so adding and removing doesn't go through all of them.
+        std::multiset<Range> m_networks;
+        bool m_is_changed = false;
+
+        // Sorted ranges that do not overlap. Replaced as a whole so the checks keep using the one they loaded.
+        std::atomic<std::shared_ptr<const std::vector<Range>>> m_ranges = std::make_shared<const std::vector<Range>>();
+    };
+} // namespace Net
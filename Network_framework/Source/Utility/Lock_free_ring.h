@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+namespace Net
+{
+    /**
+     *   Bounded queue that many threads can push to and pop from without locking.
+     *   Each cell has a sequence number that tells if it is ready for the next push or pop.
+     *   Pushing to a full ring fails instead of waiting.
+     */
+    template <typename T>
+    class Lock_free_ring
+    {
+    public:
+        // The capacity is rounded up to the next power of two
+        explicit Lock_free_ring(size_t capacity)
+            : m_capacity(std::bit_ceil(std::max<size_t>(capacity, 2))),
+              m_cells(std::make_unique<Cell[]>(m_capacity))
+        {
+            for (size_t i = 0; i < m_capacity; ++i)
+                m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+        }
+
+        Lock_free_ring(const Lock_free_ring&) = delete;
+        Lock_free_ring(Lock_free_ring&&) = delete;
+
+        ~Lock_free_ring() = default;
+
+        Lock_free_ring& operator=(const Lock_free_ring&) = delete;
+        Lock_free_ring& operator=(Lock_free_ring&&) = delete;
+
+        // Returns false if the ring is full
+        bool try_push(T item)
+        {
+            size_t position = m_push_position.load(std::memory_order_relaxed);
+
+            while (true)
+            {
+                Cell& cell = m_cells[position & (m_capacity - 1)];
+                const size_t sequence = cell.m_sequence.load(std::memory_order_acquire);
+                const auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+
+                if (difference == 0)
+                {
+                    if (m_push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        cell.m_item = std::move(item);
+                        cell.m_sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                    return false;
+                else
+                    position = m_push_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        // Returns nothing if the ring is empty
+        std::optional<T> try_pop()
+        {
+            size_t position = m_pop_position.load(std::memory_order_relaxed);
+
+            while (true)
+            {
+                Cell& cell = m_cells[position & (m_capacity - 1)];
+                const size_t sequence = cell.m_sequence.load(std::memory_order_acquire);
+                const auto difference = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+
+                if (difference == 0)
+                {
+                    if (m_pop_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        std::optional<T> item = std::move(cell.m_item);
+                        cell.m_sequence.store(position + m_capacity, std::memory_order_release);
+                        return item;
+                    }
+                }
+                else if (difference < 0)
+                    return std::nullopt;
+                else
+                    position = m_pop_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        // Might already be wrong when it returns if other threads are using the ring
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return m_push_position.load(std::memory_order_acquire) == m_pop_position.load(std::memory_order_acquire);
+        }
+
+        [[nodiscard]] size_t capacity() const noexcept
+        {
+            return m_capacity;
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> m_sequence = 0;
+            T m_item = {};
+        };
+
+        const size_t m_capacity;
+        std::unique_ptr<Cell[]> m_cells;
+
+        // On separate cache lines so the pushing and popping threads don't slow each other down
+        alignas(64) std::atomic<size_t> m_push_position = 0;
+        alignas(64) std::atomic<size_t> m_pop_position = 0;
+    };
+} // namespace Net
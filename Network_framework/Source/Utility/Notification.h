@@ -0,0 +1,181 @@
+#pragma once
+
+#include "Common.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <format>
+#include <string>
+#include <string_view>
+
+namespace Net
+{
+    // What happened. The comments tell which fields of the notification are used.
+    enum class Notification_code : uint8_t
+    {
+        none,
+
+        // Connection: m_client_id, m_address and m_error for the failures
+        handshake_succeeded,
+        handshake_failed,
+        handshake_timed_out,
+        read_idle_timed_out,
+        write_stalled,
+        header_validation_failed,
+        read_header_failed,
+        read_body_failed,
+        write_header_failed,
+        write_body_failed,
+        socket_options_failed,
+
+        // Server: m_client_id, m_address, m_error, m_value is the session id and m_text the exception
+        server_started,
+        server_stopped,
+        server_start_failed,
+        new_connection,
+        accept_failed,
+        max_connections_reached,
+        address_banned,
+        too_many_clients,
+        client_accepted,
+        client_denied,
+        client_disconnected,
+        client_lost_connection,
+        session_resume_failed,
+        session_resumed,
+        message_handler_failed,
+
+        // Client: m_error, m_value is the attempt count or the session id and m_text the exception
+        connect_exception,
+        connect_failed,
+        loopback_not_accepting,
+        shared_memory_failed,
+        reconnecting,
+        reconnect_gave_up,
+        session_not_continued,
+        session_continued,
+
+        // m_value is how many notifications did not fit in the queue. Should stay the last code.
+        notifications_dropped
+    };
+
+    static constexpr size_t NOTIFICATION_CODE_COUNT = static_cast<size_t>(Notification_code::notifications_dropped) + 1;
+
+    /**
+     *   Notification with fixed fields so it can be created without formatting or allocating.
+     *   It is formatted only if it is given to a callback that wants it as text.
+     */
+    struct Notification
+    {
+        // Copies the text and cuts it if it is too long
+        Notification& set_text(std::string_view text) noexcept
+        {
+            m_text_size = static_cast<uint8_t>(std::min(text.size(), m_text.size()));
+            std::copy_n(text.data(), m_text_size, m_text.data());
+            return *this;
+        }
+
+        [[nodiscard]] std::string_view get_text() const noexcept
+        {
+            return {m_text.data(), m_text_size};
+        }
+
+        [[nodiscard]] std::string to_string() const
+        {
+            // Sockets that don't use ip don't have address
+            const std::string ip = m_address.is_unspecified() ? "local" : m_address.to_string();
+
+            switch (m_code)
+            {
+            case Notification_code::none:
+                return std::string(get_text());
+            case Notification_code::handshake_succeeded:
+                return std::format("Succesfull handshake with {}", ip);
+            case Notification_code::handshake_failed:
+                return std::format("Error on handshake because {}", m_error.message());
+            case Notification_code::handshake_timed_out:
+                return "Handshake timed out";
+            case Notification_code::read_idle_timed_out:
+                return "Read idle timed out";
+            case Notification_code::write_stalled:
+                return "Write stalled";
+            case Notification_code::header_validation_failed:
+                return "Header validation failed";
+            case Notification_code::read_header_failed:
+                return std::format("Read header failed because {}", m_error.message());
+            case Notification_code::read_body_failed:
+                return std::format("Read body failed because {}", m_error.message());
+            case Notification_code::write_header_failed:
+                return std::format("Write header failed because {}", m_error.message());
+            case Notification_code::write_body_failed:
+                return std::format("Write body failed because {}", m_error.message());
+            case Notification_code::socket_options_failed:
+                return std::format("Failed to set socket options because {}", m_error.message());
+            case Notification_code::server_started:
+                return "Server has been started";
+            case Notification_code::server_stopped:
+                return "Server has been stopped";
+            case Notification_code::server_start_failed:
+                return std::format("Server start error: {}", get_text());
+            case Notification_code::new_connection:
+                return std::format("Server new connection: {}", ip);
+            case Notification_code::accept_failed:
+                return std::format("Server connection error: {}", m_error.message());
+            case Notification_code::max_connections_reached:
+                return "Max connections reached";
+            case Notification_code::address_banned:
+                return std::format("Client with ip {} is banned", ip);
+            case Notification_code::too_many_clients:
+                return std::format("Connection {} denied, too many clients", ip);
+            case Notification_code::client_accepted:
+                return std::format("Client with ip {} was accepted and assigned id {} to it", ip, m_client_id);
+            case Notification_code::client_denied:
+                return std::format("Connection {} denied", ip);
+            case Notification_code::client_disconnected:
+                return std::format("Client disconnected ip: {} id: {}", ip, m_client_id);
+            case Notification_code::client_lost_connection:
+                return std::format("Client lost connection ip: {} id: {}", ip, m_client_id);
+            case Notification_code::session_resume_failed:
+                return std::format("Client {} could not resume session {}", m_client_id, m_value);
+            case Notification_code::session_resumed:
+                return std::format("Client {} resumed session {}", m_client_id, m_value);
+            case Notification_code::message_handler_failed:
+                if (m_text_size == 0)
+                    return std::format("Message handler of client {} failed", m_client_id);
+
+                return std::format("Message handler of client {} failed: {}", m_client_id, get_text());
+            case Notification_code::connect_exception:
+                return std::format("Exception: {}", get_text());
+            case Notification_code::connect_failed:
+                return std::format("Error on connection because {}", m_error.message());
+            case Notification_code::loopback_not_accepting:
+                return "Server is not accepting loopback connections";
+            case Notification_code::shared_memory_failed:
+                return std::format("Error on opening shared memory because {}", m_error.message());
+            case Notification_code::reconnecting:
+                return "Lost connection to the server, reconnecting";
+            case Notification_code::reconnect_gave_up:
+                return std::format("Gave up reconnecting after {} attempts", m_value);
+            case Notification_code::session_not_continued:
+                return "Server could not continue the session";
+            case Notification_code::session_continued:
+                return std::format("Continued the session {}", m_value);
+            case Notification_code::notifications_dropped:
+                return std::format("{} notifications were dropped because the queue was full", m_value);
+            }
+
+            return "Unknown notification";
+        }
+
+        Notification_code m_code = Notification_code::none;
+        Severity m_severity = Severity::notification;
+        uint32_t m_client_id = 0;
+        uint64_t m_value = 0;
+        asio::ip::address m_address = {};
+        asio::error_code m_error = {};
+
+        // Exception messages. Kept inside the notification so it does not allocate.
+        std::array<char, 64> m_text = {};
+        uint8_t m_text_size = 0;
+    };
+} // namespace Net
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Stores the values in one contiguous array and gives each value a handle that stays valid until it is erased.
+     *   Finding a value is an index and a generation check. Erasing moves the last value to the place of the erased
+     *   one. Not thread safe.
+     *
+     *   A handle is never given twice. Freed slots are reused oldest first and a slot is retired after its last
+     *   generation, so the map can give about 4 billion handles in total before it is full.
+     */
+    template <typename T>
+    class Slot_map
+    {
+    public:
+        // Index of the slot in the low bits and its generation in the high bits. Zero is never a valid handle.
+        using Handle = uint32_t;
+
+        static constexpr uint32_t INDEX_BITS = 20;
+        static constexpr size_t MAX_SIZE = size_t(1) << INDEX_BITS;
+
+        /**
+         *   Adds the value
+         *
+         *   @return the handle of the value
+         *   @throws if there are already MAX_SIZE slots in use or retired
+         */
+        Handle insert(T value)
+        {
+            const uint32_t slot_index = allocate_slot();
+            return place(slot_index, std::move(value));
+        }
+
+        /**
+         *   Reserves a handle without a value. The value is placed to it later with insert_at.
+         *
+         *   @throws if there are already MAX_SIZE slots in use or retired
+         */
+        Handle reserve()
+        {
+            const uint32_t slot_index = allocate_slot();
+            Slot& slot = m_slots[slot_index];
+
+            slot.m_dense_index = RESERVED;
+            return slot.m_generation << INDEX_BITS | slot_index;
+        }
+
+        // Returns nullptr if the value was erased or the handle was never valid
+        [[nodiscard]] T* find(Handle handle) noexcept
+        {
+            const Slot* slot = get_slot(handle);
+            return slot != nullptr && slot->m_dense_index < m_values.size() ? &m_values[slot->m_dense_index] : nullptr;
+        }
+
+        [[nodiscard]] const T* find(Handle handle) const noexcept
+        {
+            return const_cast<Slot_map*>(this)->find(handle);
+        }
+
+        [[nodiscard]] bool contains(Handle handle) const noexcept
+        {
+            return find(handle) != nullptr;
+        }
+
+        // Erases the value and the handle becomes invalid
+        void erase(Handle handle)
+        {
+            if (find(handle) == nullptr)
+                return;
+
+            remove_value(handle);
+            free_slot(get_index(handle));
+        }
+
+        /**
+         *   Erases the value but keeps the handle reserved so a value can be placed back to it with insert_at.
+         *   The handle stays reserved until release is called.
+         */
+        void vacate(Handle handle)
+        {
+            if (find(handle) != nullptr)
+                remove_value(handle);
+        }
+
+        /**
+         *   Places the value to the handle that was reserved or vacated
+         *
+         *   @return false if the handle is not reserved
+         */
+        bool insert_at(Handle handle, T value)
+        {
+            const Slot* slot = get_slot(handle);
+            if (slot == nullptr || slot->m_dense_index != RESERVED)
+                return false;
+
+            place(get_index(handle), std::move(value));
+            return true;
+        }
+
+        // Frees the reserved or vacated handle so the slot can be used again
+        void release(Handle handle)
+        {
+            const Slot* slot = get_slot(handle);
+
+            if (slot != nullptr && slot->m_dense_index == RESERVED)
+                free_slot(get_index(handle));
+        }
+
+        // The values are in no particular order. Valid until the next insert or erase.
+        [[nodiscard]] T& value_at(size_t index) noexcept
+        {
+            return m_values[index];
+        }
+
+        [[nodiscard]] Handle handle_at(size_t index) const noexcept
+        {
+            return m_handles[index];
+        }
+
+        [[nodiscard]] auto begin() noexcept
+        {
+            return m_values.begin();
+        }
+
+        [[nodiscard]] auto end() noexcept
+        {
+            return m_values.end();
+        }
+
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return m_values.size();
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return m_values.empty();
+        }
+
+    private:
+        static constexpr uint32_t RESERVED = UINT32_MAX;
+        static constexpr uint32_t FREE = UINT32_MAX - 1;
+        static constexpr uint32_t INDEX_MASK = static_cast<uint32_t>(MAX_SIZE - 1);
+        static constexpr uint32_t MAX_GENERATION = UINT32_MAX >> INDEX_BITS;
+
+        // No handle is given with generation zero and the retired slot stays FREE so nothing is found through it
+        static constexpr uint32_t RETIRED_GENERATION = 0;
+
+        struct Slot
+        {
+            // Place of the value in m_values or RESERVED or FREE
+            uint32_t m_dense_index = FREE;
+            uint32_t m_generation = 1;
+        };
+
+        static uint32_t get_index(Handle handle) noexcept
+        {
+            return handle & INDEX_MASK;
+        }
+
+        const Slot* get_slot(Handle handle) const noexcept
+        {
+            const uint32_t index = get_index(handle);
+
+            if (index >= m_slots.size() || m_slots[index].m_generation != handle >> INDEX_BITS)
+                return nullptr;
+
+            return &m_slots[index];
+        }
+
+        uint32_t allocate_slot()
+        {
+            if (!m_free_slots.empty())
+            {
+                const uint32_t slot_index = m_free_slots.front();
+                m_free_slots.pop_front();
+                return slot_index;
+            }
+
+            if (m_slots.size() == MAX_SIZE)
+                throw std::length_error("Slot map is full");
+
+            m_slots.emplace_back();
+            return static_cast<uint32_t>(m_slots.size() - 1);
+        }
+
+        // The slot is not used again after its last generation since wrapping would repeat the old handles
+        void free_slot(uint32_t slot_index)
+        {
+            Slot& slot = m_slots[slot_index];
+            slot.m_dense_index = FREE;
+
+            if (slot.m_generation == MAX_GENERATION)
+            {
+                slot.m_generation = RETIRED_GENERATION;
+                return;
+            }
+
+            ++slot.m_generation;
+            m_free_slots.push_back(slot_index);
+        }
+
+        Handle place(uint32_t slot_index, T value)
+        {
+            Slot& slot = m_slots[slot_index];
+            const Handle handle = slot.m_generation << INDEX_BITS | slot_index;
+
+            slot.m_dense_index = static_cast<uint32_t>(m_values.size());
+            m_values.push_back(std::move(value));
+            m_handles.push_back(handle);
+
+            return handle;
+        }
+
+        // Moves the last value to the place of the removed one so the values stay contiguous
+        void remove_value(Handle handle)
+        {
+            Slot& slot = m_slots[get_index(handle)];
+            const uint32_t dense_index = slot.m_dense_index;
+
+            if (dense_index != m_values.size() - 1)
+            {
+                m_values[dense_index] = std::move(m_values.back());
+                m_handles[dense_index] = m_handles.back();
+                m_slots[get_index(m_handles[dense_index])].m_dense_index = dense_index;
+            }
+
+            m_values.pop_back();
+            m_handles.pop_back();
+            slot.m_dense_index = RESERVED;
+        }
+
+        std::vector<T> m_values;
+        std::vector<Handle> m_handles;
+        std::vector<Slot> m_slots;
+        std::deque<uint32_t> m_free_slots;
+    };
+} // namespace Net
@@ -0,0 +1,242 @@
+#pragma once
+
+#include "../Events/Delegate.h"
+#include "Common.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace Net
+{
+    /**
+     *   Hierarchical timer wheel driven by single Asio timer.
+     *   Arming and cancelling timers is O(1) so every connection can have multiple timers.
+     *   All the methods should be called from the Asio thread that runs the wheel.
+     */
+    class Timer_wheel
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Duration = std::chrono::milliseconds;
+
+        // Timer that can be armed in the wheel. Cancels itself when destroyed.
+        class Timer
+        {
+        public:
+            Timer() noexcept = default;
+
+            Timer(const Timer&) = delete;
+            Timer(Timer&&) = delete;
+
+            ~Timer()
+            {
+                cancel();
+            }
+
+            Timer& operator=(const Timer&) = delete;
+            Timer& operator=(Timer&&) = delete;
+
+            void cancel() noexcept
+            {
+                if (!is_armed())
+                    return;
+
+                m_prev->m_next = m_next;
+                m_next->m_prev = m_prev;
+                m_prev = nullptr;
+                m_next = nullptr;
+            }
+
+            [[nodiscard]] bool is_armed() const noexcept
+            {
+                return m_next != nullptr;
+            }
+
+            // Gets called from the Asio thread when the timer expires
+            Delegate<> m_on_expired;
+
+        private:
+            friend Timer_wheel;
+
+            Timer* m_prev = nullptr;
+            Timer* m_next = nullptr;
+            uint64_t m_expire_tick = 0;
+        };
+
+        Timer_wheel(asio::io_context& context, Duration resolution = Duration(10))
+            : m_driver(context), m_resolution(resolution)
+        {
+            for (auto& level : m_slots)
+                for (auto& slot : level)
+                    make_empty(slot);
+        }
+
+        Timer_wheel(const Timer_wheel&) = delete;
+        Timer_wheel(Timer_wheel&&) = delete;
+
+        ~Timer_wheel() = default;
+
+        Timer_wheel& operator=(const Timer_wheel&) = delete;
+        Timer_wheel& operator=(Timer_wheel&&) = delete;
+
+        // Starts ticking the wheel. Should be called before the Asio thread is running.
+        void start()
+        {
+            m_is_running = true;
+            m_start_time = Clock::now() - m_resolution * m_current_tick;
+            wait_for_next_tick();
+        }
+
+        // Should be called after the Asio thread has been stopped
+        void stop()
+        {
+            m_is_running = false;
+            m_driver.cancel();
+        }
+
+        /**
+         *   Arms the timer. If it was already armed it gets rearmed.
+         *   Delays longer than the wheel can hold are clamped to the max delay.
+         *
+         *   @param the timer
+         *   @param time after the timer expires
+         */
+        void schedule(Timer& timer, Duration delay) noexcept
+        {
+            timer.cancel();
+
+            constexpr auto max_delay_ticks = static_cast<int64_t>(MAX_TICKS - 1);
+            const int64_t delay_ticks = std::clamp<int64_t>(delay / m_resolution, 1, max_delay_ticks);
+            timer.m_expire_tick = m_current_tick + static_cast<uint64_t>(delay_ticks);
+            insert(timer);
+        }
+
+        [[nodiscard]] Duration get_resolution() const noexcept
+        {
+            return m_resolution;
+        }
+
+    private:
+        static constexpr uint64_t SLOT_BITS = 6;
+        static constexpr uint64_t SLOTS = 1ull << SLOT_BITS;
+        static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+        static constexpr uint64_t LEVELS = 4;
+        static constexpr uint64_t MAX_TICKS = 1ull << (SLOT_BITS * LEVELS);
+
+        // Every slot is circular list where the sentinel timer is the head
+        using Slot = Timer;
+
+        static void make_empty(Slot& slot) noexcept
+        {
+            slot.m_prev = &slot;
+            slot.m_next = &slot;
+        }
+
+        static void push_back(Slot& slot, Timer& timer) noexcept
+        {
+            timer.m_prev = slot.m_prev;
+            timer.m_next = &slot;
+            slot.m_prev->m_next = &timer;
+            slot.m_prev = &timer;
+        }
+
+        // Moves all timers from the slot to the other list
+        static void move_slot(Slot& from, Slot& to) noexcept
+        {
+            make_empty(to);
+
+            if (from.m_next == &from)
+                return;
+
+            to.m_next = from.m_next;
+            to.m_prev = from.m_prev;
+            to.m_next->m_prev = &to;
+            to.m_prev->m_next = &to;
+            make_empty(from);
+        }
+
+        // Mask for the tick bits below the level
+        static constexpr uint64_t level_mask(uint64_t level) noexcept
+        {
+            return (1ull << (SLOT_BITS * level)) - 1;
+        }
+
+        // Puts the timer in the lowest level that can hold its delay
+        void insert(Timer& timer) noexcept
+        {
+            const uint64_t delta = timer.m_expire_tick - m_current_tick;
+
+            uint64_t level = 0;
+            while (level + 1 < LEVELS && delta > level_mask(level + 1))
+                ++level;
+
+            const uint64_t slot_index = (timer.m_expire_tick >> (SLOT_BITS * level)) & SLOT_MASK;
+            push_back(m_slots.at(level).at(slot_index), timer);
+        }
+
+        // Moves timers from the higher level slot to the lower levels
+        void cascade(uint64_t level) noexcept
+        {
+            const uint64_t slot_index = (m_current_tick >> (SLOT_BITS * level)) & SLOT_MASK;
+
+            Slot cascaded;
+            move_slot(m_slots.at(level).at(slot_index), cascaded);
+
+            while (cascaded.m_next != &cascaded)
+            {
+                Timer& timer = *cascaded.m_next;
+                timer.cancel();
+                insert(timer);
+            }
+        }
+
+        void tick()
+        {
+            ++m_current_tick;
+
+            // Cascades the levels whose lower bits wrapped around starting from the highest
+            uint64_t cascade_levels = 0;
+            while (cascade_levels + 1 < LEVELS && (m_current_tick & level_mask(cascade_levels + 1)) == 0)
+                ++cascade_levels;
+
+            for (uint64_t level = cascade_levels; level > 0; --level)
+                cascade(level);
+
+            Slot expired;
+            move_slot(m_slots.at(0).at(m_current_tick & SLOT_MASK), expired);
+
+            // Timer can be cancelled or rearmed by the earlier callbacks
+            while (expired.m_next != &expired)
+            {
+                Timer& timer = *expired.m_next;
+                timer.cancel();
+                timer.m_on_expired.broadcast();
+            }
+        }
+
+        void wait_for_next_tick()
+        {
+            m_driver.expires_at(m_start_time + m_resolution * (m_current_tick + 1));
+            m_driver.async_wait([this](asio::error_code error) {
+                if (error || !m_is_running)
+                    return;
+
+                // Catches up if the thread was busy
+                const uint64_t target_tick = (Clock::now() - m_start_time) / m_resolution;
+                while (m_current_tick < target_tick)
+                    tick();
+
+                wait_for_next_tick();
+            });
+        }
+
+        asio::steady_timer m_driver;
+        Duration m_resolution;
+        Clock::time_point m_start_time;
+        uint64_t m_current_tick = 0;
+        bool m_is_running = false;
+
+        std::array<std::array<Slot, SLOTS>, LEVELS> m_slots;
+    };
+} // namespace Net
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Net
+{
+    /**
+     *   Threads that handle tasks in parallel. Tasks with the same key always go to the same worker
+     *   so they are handled in the order they were posted.
+     */
+    template <typename Task>
+    class Worker_pool
+    {
+    public:
+        using Handler = std::function<void(Task)>;
+
+        /**
+         *   Starts the workers
+         *
+         *   @param how many workers there are. Zero means one for each hardware thread.
+         *   @param handles the tasks. It is called from the worker threads at the same time.
+         */
+        Worker_pool(size_t worker_count, Handler handler) : m_handler(std::move(handler))
+        {
+            if (worker_count == 0)
+                worker_count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+            for (size_t i = 0; i < worker_count; ++i)
+                m_workers.push_back(std::make_unique<Worker>());
+
+            for (const auto& worker : m_workers)
+                worker->m_thread = std::thread([this, worker = worker.get()] { run(*worker); });
+        }
+
+        Worker_pool(const Worker_pool&) = delete;
+        Worker_pool(Worker_pool&&) = delete;
+
+        ~Worker_pool()
+        {
+            stop();
+        }
+
+        Worker_pool& operator=(const Worker_pool&) = delete;
+        Worker_pool& operator=(Worker_pool&&) = delete;
+
+        // Gives the task to the worker of the key
+        void post(size_t key, Task task)
+        {
+            Worker& worker = *m_workers[key % m_workers.size()];
+
+            {
+                std::scoped_lock lock(worker.m_mutex);
+                worker.m_tasks.push_back(std::move(task));
+                ++worker.m_queue_depth;
+            }
+
+            worker.m_condition.notify_one();
+        }
+
+        // Handles the tasks that are already posted and stops the workers
+        void stop()
+        {
+            for (const auto& worker : m_workers)
+            {
+                {
+                    std::scoped_lock lock(worker->m_mutex);
+                    worker->m_is_stopping = true;
+                }
+
+                worker->m_condition.notify_one();
+            }
+
+            for (const auto& worker : m_workers)
+                if (worker->m_thread.joinable())
+                    worker->m_thread.join();
+        }
+
+        [[nodiscard]] size_t get_worker_count() const noexcept
+        {
+            return m_workers.size();
+        }
+
+        // How many tasks are waiting or being handled by each worker
+        [[nodiscard]] std::vector<size_t> get_queue_depths() const
+        {
+            std::vector<size_t> depths;
+            depths.reserve(m_workers.size());
+
+            for (const auto& worker : m_workers)
+                depths.push_back(worker->m_queue_depth);
+
+            return depths;
+        }
+
+    private:
+        struct Worker
+        {
+            std::mutex m_mutex;
+            std::condition_variable m_condition;
+            std::deque<Task> m_tasks;
+            std::atomic<size_t> m_queue_depth = 0;
+            bool m_is_stopping = false;
+            std::thread m_thread;
+        };
+
+        void run(Worker& worker)
+        {
+            std::unique_lock lock(worker.m_mutex);
+
+            while (true)
+            {
+                worker.m_condition.wait(lock, [&worker] { return worker.m_is_stopping || !worker.m_tasks.empty(); });
+
+                if (worker.m_tasks.empty())
+                    return;
+
+                Task task = std::move(worker.m_tasks.front());
+                worker.m_tasks.pop_front();
+
+                lock.unlock();
+                m_handler(std::move(task));
+                --worker.m_queue_depth;
+                lock.lock();
+            }
+        }
+
+        Handler m_handler;
+        std::vector<std::unique_ptr<Worker>> m_workers;
+    };
+} // namespace Net
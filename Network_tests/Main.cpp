@@ -0,0 +1,388 @@
+// Asio allocates its own handler memory with the aligned functions that the counting below would not see
+#define ASIO_DISABLE_ALIGNOF
+
+#include "Sockets/Socket.h"
+#include "Utility/Interest_grid.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+/**
+ *   Tests for the things that can't be seen from the outside of the framework.
+ *   Returns the count of the failed tests so it can be run from scripts.
+ */
+
+// Every heap allocation of the program goes through these so the tests can check that the hot paths don't allocate
+std::atomic<size_t> allocation_count = 0;
+
+void* operator new(size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* pointer = std::malloc(size == 0 ? 1 : size))
+        return pointer;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    ::operator delete(pointer);
+}
+
+void operator delete(void* pointer, [[maybe_unused]] size_t size) noexcept
+{
+    ::operator delete(pointer);
+}
+
+void operator delete[](void* pointer, [[maybe_unused]] size_t size) noexcept
+{
+    ::operator delete(pointer);
+}
+
+// Prints the result of the check and counts the failures
+bool check(bool is_passed, std::string_view description)
+{
+    std::cout << (is_passed ? "passed: " : "FAILED: ") << description << "\n";
+    return is_passed;
+}
+
+/**
+ *   Peer that sends the header and the body and waits for them to come back, or writes back what it reads.
+ *   Uses the same socket and completions as the connections but without the messages that allocate their bodies.
+ */
+class Echo_peer final : public Net::Socket_handler
+{
+public:
+    static constexpr size_t HEADER_SIZE = 8;
+    static constexpr size_t BODY_SIZE = 64;
+
+    Echo_peer(Net::Protocol::socket socket, bool is_sender)
+        : m_socket(std::make_unique<Net::Template_socket<Net::Protocol::socket, Echo_peer>>(std::move(socket))),
+          m_is_sender(is_sender)
+    {
+        m_socket->set_handler(this);
+    }
+
+    Echo_peer(const Echo_peer&) = delete;
+    Echo_peer(Echo_peer&&) = delete;
+
+    ~Echo_peer() = default;
+
+    Echo_peer& operator=(const Echo_peer&) = delete;
+    Echo_peer& operator=(Echo_peer&&) = delete;
+
+    // Sends the round trips or starts writing them back
+    void start(size_t round_trips)
+    {
+        m_remaining_round_trips = round_trips;
+
+        if (m_is_sender)
+            m_socket->async_write_header(m_header.data(), m_header.size());
+        else
+            m_socket->async_read_header(m_header.data(), m_header.size());
+    }
+
+    [[nodiscard]] bool is_done() const noexcept
+    {
+        return m_remaining_round_trips == 0;
+    }
+
+    [[nodiscard]] bool has_failed() const noexcept
+    {
+        return m_has_failed;
+    }
+
+    void async_handshake_finished([[maybe_unused]] asio::error_code error) override
+    {
+    }
+
+    void async_read_header_finished(asio::error_code error, [[maybe_unused]] size_t bytes) override
+    {
+        if (!fail_if(error))
+            m_socket->async_read_body(m_body.data(), m_body.size());
+    }
+
+    void async_read_body_finished(asio::error_code error, [[maybe_unused]] size_t bytes) override
+    {
+        if (fail_if(error))
+            return;
+
+        if (!m_is_sender)
+        {
+            m_socket->async_write_header(m_header.data(), m_header.size());
+            return;
+        }
+
+        if (--m_remaining_round_trips > 0)
+            m_socket->async_write_header(m_header.data(), m_header.size());
+    }
+
+    void async_write_header_finished(asio::error_code error, [[maybe_unused]] size_t bytes) override
+    {
+        if (!fail_if(error))
+            m_socket->async_write_body(m_body.data(), m_body.size());
+    }
+
+    void async_write_body_finished(asio::error_code error, [[maybe_unused]] size_t bytes) override
+    {
+        if (!fail_if(error))
+            m_socket->async_read_header(m_header.data(), m_header.size());
+    }
+
+private:
+    bool fail_if(asio::error_code error) noexcept
+    {
+        // The echoing side sees the end of file when the test closes the sockets
+        if (error && m_is_sender)
+        {
+            m_has_failed = true;
+            m_remaining_round_trips = 0;
+        }
+
+        return static_cast<bool>(error);
+    }
+
+    std::unique_ptr<Net::Socket_interface> m_socket;
+    bool m_is_sender = false;
+    size_t m_remaining_round_trips = 0;
+    bool m_has_failed = false;
+
+    std::array<char, HEADER_SIZE> m_header = {};
+    std::array<char, BODY_SIZE> m_body = {};
+};
+
+// Runs the round trips of all the senders at the same time and returns false if any of them failed
+bool run_round_trips(asio::io_context& context, std::vector<std::unique_ptr<Echo_peer>>& peers, size_t round_trips)
+{
+    for (const auto& peer : peers)
+        peer->start(round_trips);
+
+    auto is_done = [&peers] {
+        for (const auto& peer : peers)
+            if (!peer->is_done())
+                return false;
+
+        return true;
+    };
+
+    while (!is_done())
+        context.run_one();
+
+    for (const auto& peer : peers)
+        if (peer->has_failed())
+            return false;
+
+    return true;
+}
+
+/**
+ *   Reads and writes of the sockets should not allocate after the first ones since the Asio handler state
+ *   is placed in the memory of the socket. Many connections are used so the reads and writes of different
+ *   sockets are interleaved in the same thread like they are in the servers.
+ */
+bool test_socket_reads_and_writes_do_not_allocate()
+{
+    constexpr size_t CONNECTION_COUNT = 16;
+    constexpr size_t WARM_UP_ROUND_TRIPS = 100;
+    constexpr size_t MEASURED_ROUND_TRIPS = 1000;
+
+    asio::io_context context(1);
+    Net::Protocol::acceptor acceptor(context, Net::Protocol::endpoint(asio::ip::address_v4::loopback(), 0));
+
+    std::vector<std::unique_ptr<Echo_peer>> senders;
+    std::vector<std::unique_ptr<Echo_peer>> echoers;
+
+    for (size_t i = 0; i < CONNECTION_COUNT; ++i)
+    {
+        Net::Protocol::socket sending_socket(context);
+        sending_socket.connect(acceptor.local_endpoint());
+        sending_socket.set_option(Net::Protocol::no_delay(true));
+
+        Net::Protocol::socket echoing_socket = acceptor.accept();
+        echoing_socket.set_option(Net::Protocol::no_delay(true));
+
+        senders.push_back(std::make_unique<Echo_peer>(std::move(sending_socket), true));
+        echoers.push_back(std::make_unique<Echo_peer>(std::move(echoing_socket), false));
+    }
+
+    for (const auto& echoer : echoers)
+        echoer->start(0);
+
+    bool is_passed = check(run_round_trips(context, senders, WARM_UP_ROUND_TRIPS), "warm up round trips");
+
+    const size_t allocations_before = allocation_count.load();
+    is_passed &= check(run_round_trips(context, senders, MEASURED_ROUND_TRIPS), "measured round trips");
+    const size_t allocations = allocation_count.load() - allocations_before;
+
+    // Each round trip is two reads and two writes on both sides
+    const size_t operations = CONNECTION_COUNT * MEASURED_ROUND_TRIPS * 8;
+    std::cout << "  " << allocations << " allocations in " << operations << " reads and writes\n";
+
+    return check(allocations == 0, "socket reads and writes don't allocate after warm up") && is_passed;
+}
+
+/**
+ *   The grid should find the same entities as going through all of them. The radii are chosen so that the queries
+ *   go through both the cells in the radius and all the occupied cells. Entities move and leave between the rounds.
+ */
+bool test_interest_grid_matches_brute_force()
+{
+    constexpr uint32_t ENTITY_COUNT = 500;
+    constexpr size_t QUERY_COUNT = 200;
+    constexpr float WORLD_SIZE = 100.0f;
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> coordinate(-WORLD_SIZE, WORLD_SIZE);
+    std::bernoulli_distribution is_removed(0.1);
+
+    Net::Interest_grid grid(5.0f);
+    std::vector<Net::Position> positions(ENTITY_COUNT);
+    std::vector<bool> is_in_grid(ENTITY_COUNT, false);
+
+    size_t query_count = 0;
+    size_t mismatch_count = 0;
+
+    for (const float radius : {0.0f, 1.0f, 12.0f, 80.0f, 1000.0f})
+    {
+        for (uint32_t id = 0; id < ENTITY_COUNT; ++id)
+        {
+            is_in_grid[id] = !is_removed(random);
+            positions[id] = {coordinate(random), coordinate(random)};
+
+            if (is_in_grid[id])
+                grid.set_position(id, positions[id]);
+            else
+                grid.remove(id);
+        }
+
+        mismatch_count += grid.size() != static_cast<size_t>(std::ranges::count(is_in_grid, true));
+
+        for (size_t i = 0; i < QUERY_COUNT; ++i)
+        {
+            const Net::Position center = {coordinate(random), coordinate(random)};
+
+            std::vector<uint32_t> found_ids;
+            grid.for_each_near(center, radius, [&found_ids](uint32_t id) { found_ids.push_back(id); });
+            std::ranges::sort(found_ids);
+
+            // Same float math as the grid so the entities on the edge don't differ
+            std::vector<uint32_t> expected_ids;
+
+            for (uint32_t id = 0; id < ENTITY_COUNT; ++id)
+            {
+                const float delta_x = positions[id].m_x - center.m_x;
+                const float delta_y = positions[id].m_y - center.m_y;
+
+                if (is_in_grid[id] && delta_x * delta_x + delta_y * delta_y <= radius * radius)
+                    expected_ids.push_back(id);
+            }
+
+            ++query_count;
+            mismatch_count += found_ids != expected_ids;
+        }
+    }
+
+    std::cout << "  " << mismatch_count << " of " << query_count << " queries differ from brute force\n";
+    return check(mismatch_count == 0, "interest grid finds the same entities as brute force");
+}
+
+template <typename Function_type>
+bool throws_invalid_argument(Function_type&& function)
+{
+    try
+    {
+        function();
+    }
+    catch (const std::invalid_argument&)
+    {
+        return true;
+    }
+
+    return false;
+}
+
+// Positions that don't fit to the cells go to the outermost cells and the values that are not finite are rejected
+bool test_interest_grid_clamps_and_rejects_positions()
+{
+    constexpr float MAX = std::numeric_limits<float>::max();
+    constexpr float INFINITE = std::numeric_limits<float>::infinity();
+    constexpr float NOT_A_NUMBER = std::numeric_limits<float>::quiet_NaN();
+
+    Net::Interest_grid grid(1.0f);
+    auto ignore_id = []([[maybe_unused]] uint32_t id) {};
+
+    bool is_passed = check(throws_invalid_argument([&] { grid.set_position(1, {NOT_A_NUMBER, 0.0f}); }) &&
+                               throws_invalid_argument([&] { grid.set_position(1, {0.0f, INFINITE}); }) &&
+                               throws_invalid_argument([&] { grid.set_position(1, {-INFINITE, 0.0f}); }) &&
+                               grid.size() == 0,
+                           "interest grid rejects positions that are not finite");
+
+    is_passed &= check(throws_invalid_argument([&] { grid.for_each_near({0.0f, 0.0f}, NOT_A_NUMBER, ignore_id); }) &&
+                           throws_invalid_argument([&] { grid.for_each_near({0.0f, 0.0f}, INFINITE, ignore_id); }) &&
+                           throws_invalid_argument([&] { grid.for_each_near({0.0f, 0.0f}, -1.0f, ignore_id); }) &&
+                           throws_invalid_argument([&] { grid.for_each_near({NOT_A_NUMBER, 0.0f}, 1.0f, ignore_id); }),
+                       "interest grid rejects queries that are not finite or have negative radius");
+
+    grid.set_position(1, {MAX, MAX});
+    grid.set_position(2, {-MAX, -MAX});
+    grid.set_position(3, {3e9f, -3e9f});
+    grid.set_position(4, {0.5f, 0.5f});
+
+    const Net::Grid_cell outermost_cell = {std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::min()};
+    is_passed &= check(grid.get_cell({MAX, -MAX}) == outermost_cell && grid.get_cell({3e9f, -3e9f}) == outermost_cell,
+                       "interest grid clamps the positions to the outermost cells");
+
+    auto find_ids = [&grid](Net::Position position, float radius) {
+        std::vector<uint32_t> ids;
+        grid.for_each_near(position, radius, [&ids](uint32_t id) { ids.push_back(id); });
+        std::ranges::sort(ids);
+        return ids;
+    };
+
+    is_passed &= check(find_ids({0.0f, 0.0f}, MAX) == std::vector<uint32_t>{1, 2, 3, 4} &&
+                           find_ids({MAX, MAX}, 1.0f) == std::vector<uint32_t>{1} &&
+                           find_ids({0.0f, 0.0f}, 1.0f) == std::vector<uint32_t>{4},
+                       "interest grid finds the entities in the outermost cells");
+
+    return is_passed;
+}
+
+int main()
+{
+    size_t failed_count = 0;
+
+    try
+    {
+        failed_count += !test_socket_reads_and_writes_do_not_allocate();
+        failed_count += !test_interest_grid_matches_brute_force();
+        failed_count += !test_interest_grid_clamps_and_rejects_positions();
+    }
+    catch (const std::exception& exception)
+    {
+        std::cout << "Exception: " << exception.what() << "\n";
+        ++failed_count;
+    }
+
+    std::cout << (failed_count == 0 ? "All tests passed\n" : "Some tests failed\n");
+    return static_cast<int>(failed_count);
+}